@@ -194,11 +194,13 @@ static int ps(int argc, char **argv)
 
     processes = sos_process_status(process, MAX_PROCESSES);
 
-    printf("TID SIZE   STIME   CTIME COMMAND\n");
+    printf("TID SIZE   STIME   RSS   WSS   PFF  MINFLT  MAJFLT ZEROFLT   EVICT COMMAND\n");
 
     for (i = 0; i < processes; i++) {
-        printf("%3d %4d %7d %s\n", process[i].pid, process[i].size,
-               process[i].stime, process[i].command);
+        printf("%3d %4d %7d %5u %5u %5u %7lu %7lu %7lu %7lu %s\n", process[i].pid,
+               process[i].size, process[i].stime, process[i].rss, process[i].wss,
+               process[i].pff, process[i].minflt, process[i].majflt, process[i].zeroflt,
+               process[i].evictions, process[i].command);
     }
 
     free(process);
@@ -206,6 +208,101 @@ static int ps(int argc, char **argv)
     return 0;
 }
 
+static int vmstat(int argc, char **argv)
+{
+    sos_vmstat_t stat, last = { 0 };
+    int interval = 0, count = 1;
+
+    if (argc > 3) {
+        printf("Usage: %s [interval [count]]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 1) {
+        interval = atoi(argv[1]);
+        count = argc > 2 ? atoi(argv[2]) : -1;
+    }
+
+    printf("  free  pool  zero  used   pin    pt large  swap/total   zswap/frm shared"
+           "  fault  zfill   zmap  zevict  swpin swpout  clean  pfhit pfwaste zstore   zwb"
+           "  merge    cow around afill\n");
+    for (int i = 0; count < 0 || i < count; i++) {
+        if (i > 0) {
+            sleep(interval);
+        }
+        if (sos_vmstat(&stat) == -1) {
+            printf("%s: failed to read stats\n", argv[0]);
+            return 1;
+        }
+        /* events are per interval, except for the first line */
+        printf("%6u %5u %5u %5u %5u %5u %5u %5u/%-5u %5u/%-5u %6u %6lu %6lu %6lu %7lu %6lu %6lu %6lu %6lu %7lu %6lu %5lu %6lu %6lu %6lu %5lu\n",
+               stat.untyped, stat.pooled, stat.zeroed, stat.used, stat.pinned,
+               stat.page_tables, stat.large, stat.swap_used, stat.swap_total,
+               stat.zswap_pages, stat.zswap_frames, stat.shared,
+               stat.faults - last.faults, stat.zero_fills - last.zero_fills,
+               stat.zero_maps - last.zero_maps, stat.zero_evictions - last.zero_evictions,
+               stat.swap_ins - last.swap_ins, stat.swap_outs - last.swap_outs,
+               stat.swap_clean - last.swap_clean,
+               stat.prefetch_hits - last.prefetch_hits,
+               stat.prefetch_waste - last.prefetch_waste,
+               stat.zswap_stores - last.zswap_stores,
+               stat.zswap_writebacks - last.zswap_writebacks,
+               stat.dedup_merges - last.dedup_merges,
+               stat.dedup_breaks - last.dedup_breaks,
+               stat.around_maps - last.around_maps,
+               stat.around_fills - last.around_fills);
+        last = stat;
+    }
+    return 0;
+}
+
+#define WBENCH_SIZE (1024 * 1024)
+
+/* time 1MiB writes out of one resident buffer */
+static int wbench(int argc, char **argv)
+{
+    const char *file = argc > 1 ? argv[1] : "wbench.tmp";
+    int runs = argc > 2 ? atoi(argv[2]) : 5;
+    int64_t total = 0;
+    int done = 0;
+
+    if (argc > 3 || runs <= 0) {
+        printf("Usage: %s [file [runs]]\n", argv[0]);
+        return 1;
+    }
+    char *buf = malloc(WBENCH_SIZE);
+    if (buf == NULL) {
+        printf("%s: out of memory\n", argv[0]);
+        return 1;
+    }
+    /* fault every page in first, only the copy out should be timed */
+    memset(buf, 'w', WBENCH_SIZE);
+    int fd = open(file, O_WRONLY);
+    if (fd < 0) {
+        printf("%s: can't open %s\n", argv[0], file);
+        free(buf);
+        return 1;
+    }
+    for (int i = 0; i < runs; i++) {
+        int64_t start = sos_sys_time_stamp();
+        int n = sos_sys_write(fd, buf, WBENCH_SIZE);
+        int64_t us = sos_sys_time_stamp() - start;
+        if (n != WBENCH_SIZE) {
+            printf("%s: write returned %d\n", argv[0], n);
+            break;
+        }
+        total += us;
+        done++;
+        printf("run %d: %" PRId64 " us\n", i, us);
+    }
+    if (total > 0) {
+        printf("average %" PRId64 " us, %" PRId64 " KiB/s\n", total / done,
+               (int64_t)done * (WBENCH_SIZE / 1024) * US_IN_S / total);
+    }
+    close(fd);
+    free(buf);
+    return 0;
+}
+
 static int exec(int argc, char **argv)
 {
     pid_t pid;
@@ -368,7 +465,8 @@ struct command commands[] = { { "dir", dir }, { "ls", dir }, { "cat", cat }, {
         "cp", cp
     }, { "ps", ps }, { "exec", exec }, {"sleep", second_sleep}, {"msleep", milli_sleep},
     {"time", second_time}, {"mtime", micro_time}, {"kill", kill},
-    {"benchmark", benchmark}, {"thrash", thrash}, {"id", my_id}, {"rtest", rtest}
+    {"benchmark", benchmark}, {"thrash", thrash}, {"id", my_id}, {"rtest", rtest},
+    {"vmstat", vmstat}, {"wbench", wbench}
 };
 
 int main(void)
@@ -0,0 +1,171 @@
+/*
+ * Host benchmark for liblz on page sized blocks, to judge what the
+ * compressed swap tier in SOS can expect.
+ *
+ *   lzbench            synthetic zero/text/random/mixed pages
+ *   lzbench FILE...    every 4K page of each file
+ */
+#include <lz/lz.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PAGE 4096
+#define ROUNDS 2000
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(const char *name, const unsigned char *pages, size_t npages)
+{
+    static lz_ctx_t ctx;
+    static unsigned char out[PAGE + PAGE / 255 + 16], back[PAGE];
+    size_t in = 0, comp = 0, stored = 0;
+    double tc = 0, td = 0;
+
+    for (size_t p = 0; p < npages; p++) {
+        const unsigned char *page = pages + p * PAGE;
+        size_t len = 0;
+        double t = now();
+        for (int r = 0; r < ROUNDS; r++) {
+            len = lz_compress(&ctx, page, PAGE, out, sizeof(out));
+        }
+        tc += now() - t;
+        if (len == 0) {
+            printf("%s: page %zu did not compress\n", name, p);
+            return -1;
+        }
+        int n = 0;
+        t = now();
+        for (int r = 0; r < ROUNDS; r++) {
+            n = lz_decompress(out, len, back, sizeof(back));
+        }
+        td += now() - t;
+        if (n != PAGE || memcmp(page, back, PAGE)) {
+            printf("%s: page %zu does not round trip\n", name, p);
+            return -1;
+        }
+        in += PAGE;
+        comp += len;
+        /* what SOS keeps in memory: a quarter of the page saved at least */
+        if (len <= PAGE * 3 / 4) {
+            stored++;
+        }
+    }
+    double mb = (double)in * ROUNDS / (1024 * 1024);
+    printf("%-10s %6zu pages  ratio %5.2f  kept %3zu%%  comp %7.1f MB/s  decomp %7.1f MB/s\n",
+           name, npages, (double)in / comp, stored * 100 / npages, mb / tc, mb / td);
+    return 0;
+}
+
+static void fill_text(unsigned char *p)
+{
+    static const char *words[] = { "the", "page", "frame", "swap", "of", "table", "process",
+                                   "fault", "and", "a", "to", "memory", "\n", "    " };
+    size_t i = 0;
+    while (i < PAGE) {
+        const char *w = words[rand() % (sizeof(words) / sizeof(words[0]))];
+        while (*w && i < PAGE) {
+            p[i++] = *w++;
+        }
+        if (i < PAGE) {
+            p[i++] = ' ';
+        }
+    }
+}
+
+static void fill_mixed(unsigned char *p)
+{
+    /* a heap-like page: small structs with pointers, counters and padding */
+    memset(p, 0, PAGE);
+    for (size_t i = 0; i + 32 <= PAGE; i += 32) {
+        unsigned long ptr = 0x10000000ul + (rand() % 256) * 64;
+        unsigned count = rand() % 16;
+        memcpy(p + i, &ptr, sizeof(ptr));
+        memcpy(p + i + 8, &count, sizeof(count));
+    }
+}
+
+static int synthetic(void)
+{
+    enum { N = 16 };
+    unsigned char *pages = malloc(N * PAGE);
+    if (pages == NULL) {
+        return -1;
+    }
+    int err = 0;
+
+    memset(pages, 0, N * PAGE);
+    err |= bench("zero", pages, N);
+
+    for (int i = 0; i < N; i++) {
+        fill_text(pages + i * PAGE);
+    }
+    err |= bench("text", pages, N);
+
+    for (size_t i = 0; i < N * PAGE; i++) {
+        pages[i] = rand();
+    }
+    err |= bench("random", pages, N);
+
+    for (int i = 0; i < N; i++) {
+        fill_mixed(pages + i * PAGE);
+    }
+    err |= bench("mixed", pages, N);
+
+    free(pages);
+    return err;
+}
+
+static int file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    size_t cap = 64, n = 0;
+    unsigned char *pages = malloc(cap * PAGE);
+    while (pages != NULL) {
+        if (n == cap) {
+            cap *= 2;
+            unsigned char *grown = realloc(pages, cap * PAGE);
+            if (grown == NULL) {
+                break;
+            }
+            pages = grown;
+        }
+        /* a short last page is padded with zeroes, like a mapped file */
+        memset(pages + n * PAGE, 0, PAGE);
+        if (fread(pages + n * PAGE, 1, PAGE, f) == 0) {
+            break;
+        }
+        n++;
+    }
+    fclose(f);
+    if (pages == NULL || n == 0) {
+        free(pages);
+        return pages == NULL ? -1 : 0;
+    }
+    const char *name = strrchr(path, '/');
+    int err = bench(name ? name + 1 : path, pages, n);
+    free(pages);
+    return err;
+}
+
+int main(int argc, char *argv[])
+{
+    int err = 0;
+    if (argc < 2) {
+        err = synthetic();
+    }
+    for (int i = 1; i < argc; i++) {
+        err |= file(argv[i]);
+    }
+    return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+/*
+ * A small LZ77 block compressor in the style of LZ4, meant for single pages.
+ * It has no dependencies past the C library so it builds for SOS and on a
+ * Linux host alike.
+ *
+ * A block is a list of sequences. Each starts with a token byte whose high
+ * nibble is the literal count and low nibble the match length - LZ_MIN_MATCH,
+ * a nibble of 15 means more length bytes follow (each adding up to 255).
+ * Then come the literals, a little endian 16 bit match offset and the extra
+ * match length bytes. The last sequence only has literals.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 11
+/* matches are found through 16 bit positions, inputs can't be larger */
+#define LZ_MAX_INPUT 0xffff
+
+/* hash table of the compressor, one per concurrent user */
+typedef struct lz_ctx {
+    uint16_t table[1 << LZ_HASH_BITS];
+} lz_ctx_t;
+
+/*
+ * Compress len bytes of src into dst, which has room for cap bytes.
+ * Returns the compressed size, or 0 if it doesn't fit into cap (or len is
+ * over LZ_MAX_INPUT), so a caller can pass cap < len to only keep blocks
+ * that are worth it.
+ */
+size_t lz_compress(lz_ctx_t *ctx, const void *src, size_t len, void *dst, size_t cap);
+
+/*
+ * Decompress a block of len bytes into dst, which has room for cap bytes.
+ * Returns the decompressed size, or -1 if the block is malformed or does
+ * not fit.
+ */
+int lz_decompress(const void *src, size_t len, void *dst, size_t cap);
@@ -0,0 +1,168 @@
+#include <lz/lz.h>
+#include <string.h>
+
+/* the last bytes are always literals, so the match finder can read ahead */
+#define LZ_LAST_LITERALS 5
+#define LZ_MF_LIMIT 12
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline unsigned hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* 15 in the nibble, the rest as a run of bytes */
+static uint8_t *put_length(uint8_t *op, size_t n)
+{
+    while (n >= 255) {
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = n;
+    return op;
+}
+
+/* one sequence, mlen == 0 for the trailing literals. NULL if it won't fit */
+static uint8_t *put_sequence(uint8_t *op, uint8_t *oend, const uint8_t *lit,
+                             size_t nlit, size_t offset, size_t mlen)
+{
+    size_t need = 1 + nlit + nlit / 255 + 1 + (mlen ? 2 + mlen / 255 + 1 : 0);
+    if (need > (size_t)(oend - op)) {
+        return NULL;
+    }
+    size_t mcode = mlen ? mlen - LZ_MIN_MATCH : 0;
+    uint8_t *token = op++;
+    *token = (nlit < 15 ? nlit : 15) << 4 | (mcode < 15 ? mcode : 15);
+    if (nlit >= 15) {
+        op = put_length(op, nlit - 15);
+    }
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (mlen) {
+        *op++ = offset & 0xff;
+        *op++ = offset >> 8;
+        if (mcode >= 15) {
+            op = put_length(op, mcode - 15);
+        }
+    }
+    return op;
+}
+
+size_t lz_compress(lz_ctx_t *ctx, const void *source, size_t len, void *dest, size_t cap)
+{
+    const uint8_t *src = source;
+    const uint8_t *ip = src, *anchor = src, *end = src + len;
+    uint8_t *op = dest, *oend = op + cap;
+
+    if (len > LZ_MAX_INPUT) {
+        return 0;
+    }
+    memset(ctx->table, 0, sizeof(ctx->table));
+
+    if (len > LZ_MF_LIMIT) {
+        const uint8_t *mflimit = end - LZ_MF_LIMIT;
+        const uint8_t *mlimit = end - LZ_LAST_LITERALS;
+        /* position 0 is what an empty slot points at, so start past it */
+        ip++;
+        while (ip < mflimit) {
+            uint32_t seq = read32(ip);
+            unsigned h = hash(seq);
+            const uint8_t *ref = src + ctx->table[h];
+            ctx->table[h] = ip - src;
+            if (read32(ref) != seq || ref >= ip) {
+                ip++;
+                continue;
+            }
+            /* grow the match backwards into the pending literals */
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            size_t mlen = LZ_MIN_MATCH;
+            while (ip + mlen < mlimit && ip[mlen] == ref[mlen]) {
+                mlen++;
+            }
+            op = put_sequence(op, oend, anchor, ip - anchor, ip - ref, mlen);
+            if (op == NULL) {
+                return 0;
+            }
+            ip += mlen;
+            anchor = ip;
+        }
+    }
+    op = put_sequence(op, oend, anchor, end - anchor, 0, 0);
+    if (op == NULL) {
+        return 0;
+    }
+    return op - (uint8_t *)dest;
+}
+
+/* a length that continues past its nibble, -1 if the block ends first */
+static int get_length(const uint8_t **ip, const uint8_t *iend, size_t *n)
+{
+    uint8_t b;
+    do {
+        if (*ip >= iend) {
+            return -1;
+        }
+        b = *(*ip)++;
+        *n += b;
+    } while (b == 255);
+    return 0;
+}
+
+int lz_decompress(const void *source, size_t len, void *dest, size_t cap)
+{
+    const uint8_t *ip = source, *iend = ip + len;
+    uint8_t *op = dest, *oend = op + cap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t nlit = token >> 4;
+        if (nlit == 15 && get_length(&ip, iend, &nlit)) {
+            return -1;
+        }
+        if (nlit > (size_t)(iend - ip) || nlit > (size_t)(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, nlit);
+        op += nlit;
+        ip += nlit;
+        if (ip == iend) {
+            /* trailing literals */
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        size_t mlen = token & 15;
+        if (mlen == 15 && get_length(&ip, iend, &mlen)) {
+            return -1;
+        }
+        mlen += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - (uint8_t *)dest)
+            || mlen > (size_t)(oend - op)) {
+            return -1;
+        }
+        const uint8_t *ref = op - offset;
+        if (offset >= mlen) {
+            memcpy(op, ref, mlen);
+            op += mlen;
+        } else {
+            /* byte by byte, the match overlaps what it produces */
+            while (mlen--) {
+                *op++ = *ref++;
+            }
+        }
+    }
+    return op - (uint8_t *)dest;
+}
@@ -32,6 +32,7 @@
 #define SOS_SYS_PROCESS_WAIT        10
 #define SOS_SYS_TIMESTAMP           11
 #define SOS_SYS_USLEEP              12
+#define SOS_SYS_VMSTAT              13
 #define SOS_SYSCALLMSG              100
 #define SOS_SYSCALLBRK              101
 #define SOS_SYSCALL_MMAP            102
@@ -76,8 +77,46 @@ typedef struct {
     unsigned  size;            /* in pages */
     unsigned  stime;           /* start time in msec since booting */
     char      command[N_NAME]; /* Name of exectuable */
+    unsigned  rss;             /* pages in memory */
+    unsigned  wss;             /* pages used over the last clock sweeps, 0 before the first */
+    unsigned  pff;             /* faults per second over the last window */
+    unsigned long minflt;      /* faults mapping a page still in memory */
+    unsigned long majflt;      /* faults reading a page back from swap */
+    unsigned long zeroflt;     /* faults on pages of zeros */
+    unsigned long evictions;   /* pages the clock took away */
 } sos_process_t;
 
+typedef struct {
+    unsigned  frames;          /* frames the frame table manages */
+    unsigned  untyped;         /* not backed by memory yet */
+    unsigned  pooled;          /* free but kept retyped and mapped in SOS */
+    unsigned  zeroed;          /* pooled frames already cleared */
+    unsigned  used;            /* user pages the clock may evict */
+    unsigned  pinned;          /* in use and never evicted */
+    unsigned  page_tables;     /* holding shadow page tables */
+    unsigned  large;           /* 2M frames mapped by processes */
+    unsigned  swap_used;       /* swap file slots holding pages */
+    unsigned  swap_total;      /* slots the swap file has grown to */
+    unsigned  zswap_pages;     /* pages kept compressed in memory */
+    unsigned  zswap_frames;    /* frames the compressed pool takes */
+    unsigned  shared;          /* user pages merged into another's frame */
+    unsigned long faults;      /* since boot */
+    unsigned long swap_ins;
+    unsigned long swap_outs;
+    unsigned long zero_fills;      /* frames allocated for pages of zeros */
+    unsigned long zero_maps;       /* read faults served by the shared zero frame */
+    unsigned long zero_evictions;  /* victims of zeros, dropped without I/O */
+    unsigned long prefetch_hits;   /* read-around pages faulted on */
+    unsigned long prefetch_waste;  /* read-around pages dropped untouched */
+    unsigned long swap_clean;      /* evictions whose slot was still good */
+    unsigned long zswap_stores;    /* evictions into the compressed pool */
+    unsigned long zswap_writebacks;    /* pool pages moved on to the file */
+    unsigned long dedup_merges;    /* identical pages merged by the scanner */
+    unsigned long dedup_breaks;    /* merged pages copied on a write */
+    unsigned long around_maps;     /* resident pages mapped around a fault */
+    unsigned long around_fills;    /* zeroed frames mapped around a fault */
+} sos_vmstat_t;
+
 /* I/O system calls */
 
 int sos_sys_open(const char *path, fmode_t mode);
@@ -137,6 +176,11 @@ int sos_process_status(sos_process_t *processes, unsigned max);
  * returns number of process descriptors actually returned.
  */
 
+int sos_vmstat(sos_vmstat_t *stat);
+/* Returns a snapshot of the frame table and swap file through "stat".
+ * Returns 0 if successful, -1 otherwise.
+ */
+
 pid_t sos_process_wait(pid_t pid);
 /* Wait for process "pid" to exit. If "pid" is -1, wait for any process
  * to exit. Returns the pid of the process which exited.
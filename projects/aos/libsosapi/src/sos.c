@@ -158,6 +158,19 @@ int sos_process_status(sos_process_t *processes, unsigned max)
     return ret;
 }
 
+int sos_vmstat(sos_vmstat_t *stat)
+{
+    seL4_MessageInfo_t tag;
+    tag = seL4_MessageInfo_new(0, 0, 0, 2);
+    seL4_SetMR(0, SOS_SYS_VMSTAT);
+    seL4_SetMR(1, (seL4_Word)stat);
+
+    seL4_Call(SOS_IPC_EP_CAP, tag);
+
+    int ret = seL4_GetMR(0);
+    return ret;
+}
+
 pid_t sos_process_wait(pid_t pid)
 {
     seL4_MessageInfo_t tag;
@@ -0,0 +1,206 @@
+/*
+ * Host benchmark for the leaf table walk of the SOS page table, with and
+ * without the translation cache in front of it. Builds a sparse table
+ * shaped like a process (image, heap, mmap and stack) out of a host arena
+ * standing in for the frame window, then times get_n_level_table (what
+ * SosXlateEntries=0 leaves) against get_leaf_table.
+ *
+ *   xlatebench            every workload
+ *
+ * -DXLATE_ENTRIES=n builds it for another cache size, as SosXlateEntries does
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef uint64_t seL4_Word;
+
+#define seL4_LargePageBits 21
+#define PAGE_SIZE_4K 4096lu
+#define PAGE_TABLE_SIZE 512
+#define PAGE_TABLE_FRAME_SIZE 1
+#define MASK(n) ((1lu << (n)) - 1)
+#define MAX_UNSAFE(a, b) ((a) > (b) ? (a) : (b))
+#define FRAME_BASE ((seL4_Word)arena)
+
+static unsigned char *arena;
+
+/* SOS leaves the cache off, the benchmark is about what it does when on */
+#ifndef XLATE_ENTRIES
+#define XLATE_ENTRIES 256
+#endif
+
+#include "../src/xlate.h"
+
+/* as pagetable.c has it, the cache is the second frame of the top table */
+_Static_assert(sizeof(xlate_cache) <= PAGE_SIZE_4K, "xlate cache over a frame");
+
+#define ARENA_FRAMES 4096
+#define LOOKUPS 20000000
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static seL4_Word frames = 1;
+
+static seL4_Word frame_alloc(void)
+{
+    if (frames == ARENA_FRAMES) {
+        fprintf(stderr, "arena is full\n");
+        exit(1);
+    }
+    return frames++;
+}
+
+/* give vaddr a level 4 table, the way the fault path would */
+static void map_range(page_table_t *top, seL4_Word start, seL4_Word size)
+{
+    for (seL4_Word vaddr = start; vaddr < start + size; vaddr += PAGE_SIZE_4K) {
+        page_table_t *pt = top;
+        for (int level = 1; level < 4; level++) {
+            seL4_Word *entry = &pt->page_obj_addr[get_offset(vaddr, level)];
+            if (ENTRY_FRAME(*entry) == 0) {
+                *entry = frame_alloc();
+            }
+            pt = NODE_TABLE(*entry);
+        }
+        pt->page_obj_addr[get_offset(vaddr, 4)] = vaddr;
+    }
+}
+
+static seL4_Word rng = 88172645463325252lu;
+
+static seL4_Word xorshift(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static seL4_Word walk_uncached(page_table_t *top, const seL4_Word *addrs, size_t n)
+{
+    seL4_Word sum = 0;
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        seL4_Word vaddr = addrs[i % n];
+        page_table_t *pt4 = (page_table_t *)get_n_level_table((seL4_Word)top, vaddr, 4);
+        sum += pt4->page_obj_addr[get_offset(vaddr, 4)];
+    }
+    return sum;
+}
+
+static seL4_Word walk_cached(page_table_t *top, const seL4_Word *addrs, size_t n)
+{
+    seL4_Word sum = 0;
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        seL4_Word vaddr = addrs[i % n];
+        page_table_t *pt4 = get_leaf_table(top, vaddr);
+        sum += pt4->page_obj_addr[get_offset(vaddr, 4)];
+    }
+    return sum;
+}
+
+static int bench(const char *name, page_table_t *top, const seL4_Word *addrs, size_t n)
+{
+    memset(get_xlate_cache(top), 0, sizeof(xlate_cache));
+
+    double t = now();
+    seL4_Word plain = walk_uncached(top, addrs, n);
+    double tu = now() - t;
+
+    t = now();
+    seL4_Word cached = walk_cached(top, addrs, n);
+    double tc = now() - t;
+
+    if (plain != cached) {
+        printf("%s: the cached walk found other tables\n", name);
+        return 1;
+    }
+    printf("%-12s %8.2f ns uncached %8.2f ns cached %6.2fx\n", name,
+           tu * 1e9 / LOOKUPS, tc * 1e9 / LOOKUPS, tu / tc);
+    return 0;
+}
+
+int main(void)
+{
+    arena = aligned_alloc(PAGE_SIZE_4K, ARENA_FRAMES * PAGE_SIZE_4K);
+    if (arena == NULL) {
+        return 1;
+    }
+    memset(arena, 0, ARENA_FRAMES * PAGE_SIZE_4K);
+
+    /* the top level table is two frames, the second holds the cache */
+    seL4_Word top_frame = frame_alloc();
+    frame_alloc();
+    page_table_t *top = NODE_TABLE(top_frame);
+
+    struct {
+        seL4_Word start, size;
+    } regions[] = {
+        { 0x400000lu,       4lu << 20 },   /* image */
+        { 0x2000000lu,    128lu << 20 },   /* heap */
+        { 0x7f0000000000lu, 256lu << 20 }, /* mmap */
+        { 0x7fffff000000lu, 16lu << 20 },  /* stack */
+    };
+    size_t nregions = sizeof(regions) / sizeof(regions[0]);
+
+    size_t npages = 0;
+    for (size_t r = 0; r < nregions; r++) {
+        map_range(top, regions[r].start, regions[r].size);
+        npages += regions[r].size / PAGE_SIZE_4K;
+    }
+
+    seL4_Word *addrs = malloc(npages * sizeof(seL4_Word));
+    if (addrs == NULL) {
+        return 1;
+    }
+    printf("xlate entries %d, %zu pages in %zu tables\n", XLATE_ENTRIES, npages,
+           (size_t)frames);
+
+    int err = 0;
+
+    /* every page of every region in order, as a copy in or out walks them */
+    size_t n = 0;
+    for (size_t r = 0; r < nregions; r++) {
+        for (seL4_Word off = 0; off < regions[r].size; off += PAGE_SIZE_4K) {
+            addrs[n++] = regions[r].start + off;
+        }
+    }
+    err |= bench("pages", top, addrs, n);
+
+    /* a byte at a time through a 64K buffer on the heap, as copystr does */
+    n = 0;
+    for (seL4_Word off = 0; off < 64 * 1024; off++) {
+        addrs[n++] = regions[1].start + (1lu << 20) + off;
+    }
+    err |= bench("bytes", top, addrs, n);
+
+    /* a small working set: the stack top, some heap and the image */
+    n = 0;
+    for (size_t i = 0; i < 4096; i++) {
+        static const size_t hot[] = { 0, 1, 3 };
+        size_t r = hot[xorshift() % 3];
+        seL4_Word size = r == 1 ? 8lu << 20 : regions[r].size;
+        seL4_Word base = r == 3 ? regions[r].start + regions[r].size - size : regions[r].start;
+        addrs[n++] = base + (xorshift() % size & ~(PAGE_SIZE_4K - 1));
+    }
+    err |= bench("working set", top, addrs, n);
+
+    /* pages at random over everything mapped, past what the cache holds */
+    n = 0;
+    for (size_t i = 0; i < npages; i++) {
+        size_t r = xorshift() % nregions;
+        addrs[n++] = regions[r].start + (xorshift() % regions[r].size & ~(PAGE_SIZE_4K - 1));
+    }
+    err |= bench("random", top, addrs, n);
+
+    free(addrs);
+    free(arena);
+    return err;
+}
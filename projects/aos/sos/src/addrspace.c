@@ -1,13 +1,10 @@
 #include <cspace/cspace.h>
+#include <string.h>
 
 #include "addrspace.h"
 #include "pagetable.h"
 #include "proc.h"
 
-#define PRESENT (1lu << 50)
-#define PAGE_RW (1lu << 51)
-#define OFFSET 0xffffffffffff
-
 proc *cur_proc;
 addrspace *addrspace_init(void)
 {
@@ -16,10 +13,109 @@ addrspace *addrspace_init(void)
     if (!as)
         return NULL;
     as->regions = NULL;
+    as->index = NULL;
+    as->nregions = 0;
+    as->capacity = 0;
+    as->gaps = NULL;
+    as->hint = NULL;
+    as->stack = NULL;
     as->heap = NULL;
+    as->ipcbuffer = NULL;
     return as;
 }
 
+/* index position of the last region starting at or below vaddr, -1 if none */
+static int index_find(addrspace *as, seL4_Word vaddr)
+{
+    int lo = 0, hi = as->nregions;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (as->index[mid]->vaddr <= vaddr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+/* room for mmap between region i and the next, past a guard page */
+static seL4_Word gap_after(addrspace *as, unsigned i)
+{
+    if (i + 1 >= as->nregions) {
+        return 0;
+    }
+    as_region *region = as->index[i];
+    seL4_Word base = ((region->vaddr + region->size) & PAGE_FRAME) + PAGE_SIZE_4K;
+    seL4_Word top = as->index[i + 1]->vaddr;
+    return top > base ? top - base : 0;
+}
+
+static void gap_update(addrspace *as, unsigned i)
+{
+    unsigned n = as->capacity + i;
+    as->gaps[n] = gap_after(as, i);
+    for (n /= 2; n > 0; n /= 2) {
+        as->gaps[n] = MAX(as->gaps[2 * n], as->gaps[2 * n + 1]);
+    }
+}
+
+/* the gaps of regions from i on moved, with everything above them */
+static void gaps_rebuild(addrspace *as, unsigned i)
+{
+    for (; i < as->capacity; ++i) {
+        as->gaps[as->capacity + i] = gap_after(as, i);
+    }
+    for (unsigned n = as->capacity - 1; n > 0; --n) {
+        as->gaps[n] = MAX(as->gaps[2 * n], as->gaps[2 * n + 1]);
+    }
+}
+
+/* room for one more region, the capacity stays a power of two */
+static int index_grow(addrspace *as)
+{
+    if (as->nregions < as->capacity) {
+        return 0;
+    }
+    unsigned capacity = as->capacity ? as->capacity * 2 : 8;
+    as_region **index = realloc(as->index, capacity * sizeof(as_region *));
+    if (index == NULL) {
+        return -1;
+    }
+    as->index = index;
+    seL4_Word *gaps = realloc(as->gaps, 2 * capacity * sizeof(seL4_Word));
+    if (gaps == NULL) {
+        return -1;
+    }
+    as->gaps = gaps;
+    as->capacity = capacity;
+    gaps_rebuild(as, 0);
+    return 0;
+}
+
+static void index_remove(addrspace *as, as_region *region)
+{
+    int pos = index_find(as, region->vaddr);
+    while (pos >= 0 && as->index[pos] != region) {
+        pos--;
+    }
+    if (pos < 0) {
+        return;
+    }
+    if (pos > 0) {
+        as->index[pos - 1]->next = region->next;
+    } else {
+        as->regions = region->next;
+    }
+    memmove(&as->index[pos], &as->index[pos + 1],
+            (as->nregions - pos - 1) * sizeof(as_region *));
+    as->nregions--;
+    if (as->hint == region) {
+        as->hint = NULL;
+    }
+    gaps_rebuild(as, pos ? pos - 1 : 0);
+}
+
 static int create_region(as_region *region,
                          seL4_Word vaddr, size_t memsize,
                          unsigned char flag)
@@ -52,6 +148,30 @@ static int create_region(as_region *region,
     return 0;
 }
 
+/* a run of pages of a region going away */
+static void destroy_run(proc *process, seL4_Word vaddr, unsigned npages, UNUSED void *arg)
+{
+    if (is_large_page(process->pt, vaddr)) {
+        /* a large page never straddles a region, so it all goes */
+        destroy_large_page(process, vaddr);
+        return;
+    }
+    for (unsigned i = 0; i < npages; ++i, vaddr += PAGE_SIZE_4K) {
+        seL4_Word frame = _get_frame_from_vaddr(process->pt, vaddr);
+        /* the entry is cleared and its cap goes, mapped by the clock or not */
+        update_page_status(process->pt, vaddr, false, false, 0);
+        if (!(frame & PRESENT) && (frame & ZERO_PAGE)) {
+            /* nothing behind it but maybe a mapping of the zero frame */
+        } else if (!(frame & PRESENT)) {
+            clean_up_swapping(frame);
+        } else {
+            frame = (int) frame;
+            frame_rmap_remove(frame, process->status.pid, vaddr);
+            frame_free(frame);
+        }
+    }
+}
+
 /* destroying a region is just unmap all it's frame.
  * need to be careful since one frame may contain more than one
  * region.
@@ -61,20 +181,6 @@ void as_destroy_region(addrspace *as, as_region *region, proc *cur_proc)
     seL4_Word first_vaddr = region->vaddr & PAGE_FRAME;
     seL4_Word last_vaddr = (region->vaddr + region->size - 1) & PAGE_FRAME;
 
-    /* check first frame */
-    as_region *tmp = as->regions;
-    // while (tmp) {
-    //     if (tmp->vaddr + tmp->size > first_vaddr) {
-    //         if (tmp->vaddr < first_vaddr) {
-    //             /* region overlapped */
-    //             /* start from second frame */
-    //             first_vaddr += PAGE_SIZE_4K;
-    //         }
-    //         break;
-    //     }
-    //     tmp = tmp->next;
-    // }
-
     /* check last frame */
     if (region->next && (region->next->vaddr & PAGE_FRAME) == last_vaddr) {
         /* last frame overlap */
@@ -84,46 +190,10 @@ void as_destroy_region(addrspace *as, as_region *region, proc *cur_proc)
     //printf("first %p, last %p\n", (void *)first_vaddr, (void *)last_vaddr);
 
     // printf("try clean up\n");
-    for (seL4_Word i = first_vaddr; i <= last_vaddr; i += PAGE_SIZE_4K) {
-        // printf("destroy %p\n", i);
-        seL4_Word frame = _get_frame_from_vaddr(cur_proc->pt, i);
-        seL4_Word slot = get_cap_from_vaddr(cur_proc->pt, i);
-        if (frame == 0) {
-            continue;
-        } else if (!(frame & PRESENT)) {
-            // printf("clean swap\n");
-            clean_up_swapping(frame & OFFSET);
-            // printf("clean swap done\n");
-        } else if (frame != 0 && slot != 0) {
-            frame = (int) frame;
-            int clock_bit = FRAME_GET_BIT(frame, CLOCK);
-            if (clock_bit) {
-                seL4_ARM_Page_Unmap(slot);
-                cspace_delete(global_cspace, slot);
-                cspace_free_slot(global_cspace, slot);
-            }
-            frame_free(frame);
-        }
-    }
-    tmp = as->regions;
-
-    //printf("sort region\n");
-    /* we are first region */
-    if (tmp == region) {
-        as->regions = tmp->next;
-        free(region);
-        return;
-    }
-
-    /* we are not first */
-    while (tmp) {
-        if (tmp->next == region) {
-            tmp->next = region->next;
-            free(region);
-            return;
-        }
-        tmp = tmp->next;
-    }
+    page_range_walk(cur_proc, first_vaddr, last_vaddr + PAGE_SIZE_4K, destroy_run, NULL);
+    page_range_trim(cur_proc->pt, first_vaddr, last_vaddr + PAGE_SIZE_4K);
+    index_remove(as, region);
+    free(region);
 }
 
 void destroy_regions(addrspace *as, proc *cur_proc)
@@ -134,52 +204,43 @@ void destroy_regions(addrspace *as, proc *cur_proc)
         as_destroy_region(as, region, cur_proc);
         region = as->regions;
     }
+    free(as->index);
+    free(as->gaps);
+    as->index = NULL;
+    as->gaps = NULL;
+    as->capacity = 0;
 }
 /* make region list ordered by check each region
  * this also prevent regions from overlap with each other
  */
 static int insert_region(addrspace *as, as_region *region)
 {
-    seL4_Word vaddr;
-    vaddr = region->vaddr;
+    seL4_Word vaddr = region->vaddr;
 
-    if (as->regions == NULL) {
-        // first region
-        as->regions = region;
+    if (index_grow(as)) {
+        free(region);
+        return -1;
+    }
+    int pos = index_find(as, vaddr) + 1;
+    as_region *prev = pos > 0 ? as->index[pos - 1] : NULL;
+    as_region *next = pos < (int)as->nregions ? as->index[pos] : NULL;
+    // overlap
+    if ((prev && vaddr > prev->vaddr && vaddr - prev->vaddr < prev->size)
+        || (next && vaddr + region->size > next->vaddr)) {
+        free(region);
+        return -1;
+    }
+    region->next = next;
+    if (prev) {
+        prev->next = region;
     } else {
-        as_region *tmp = as->regions;
-        as_region *prev = NULL;
-        // check overlap
-        while (tmp) {
-            // overlap
-            if (vaddr > tmp->vaddr && vaddr - tmp->vaddr < tmp->size) {
-                free(region);
-                return -1;
-            }
-            // first region
-            if (vaddr < tmp->vaddr) {
-                // check overlap
-                if (vaddr + region->size > tmp->vaddr) {
-                    free(region);
-                    return -1;
-                }
-                region->next = tmp;
-
-                if (prev == NULL) {
-                    as->regions = region;
-                } else {
-                    prev->next = region;
-                }
-                break;
-            }
-            prev = tmp;
-            tmp = tmp->next;
-        }
-        if (tmp == NULL) {
-            prev->next = region;
-        }
+        as->regions = region;
     }
-
+    memmove(&as->index[pos + 1], &as->index[pos],
+            (as->nregions - pos) * sizeof(as_region *));
+    as->index[pos] = region;
+    as->nregions++;
+    gaps_rebuild(as, pos ? pos - 1 : 0);
     return 0;
 }
 
@@ -209,7 +270,8 @@ int as_define_stack(addrspace *as)
     /* Initial user-level stack pointer */
     as_region *region;
     int stacksize = USERSTACKSIZE; // 16M stack
-    region = as_define_region(as, USERSTACKTOP - stacksize, stacksize, RG_R | RG_W);
+    region = as_define_region(as, USERSTACKTOP - stacksize, stacksize,
+                              RG_R | RG_W | RG_LARGE);
     if (region == NULL) {
         return -1;
     }
@@ -237,7 +299,7 @@ int as_define_heap(addrspace *as)
 {
     /* Initial user-level stack pointer */
     as_region *region;
-    region = as_define_region(as, USERHEAPBASE, 0, RG_R | RG_W);
+    region = as_define_region(as, USERHEAPBASE, 0, RG_R | RG_W | RG_LARGE);
     if (region == NULL) {
         return -1;
     }
@@ -250,17 +312,14 @@ int as_define_heap(addrspace *as)
 bool validate_virtual_address(addrspace *as, seL4_Word vaddr, size_t size,
                               enum OPERATION operation)
 {
-    as_region *region = as->regions;
-    while (region) {
-        if (vaddr >= region->vaddr && vaddr + size < region->vaddr + region->size) {
-            if (operation == READ) {
-                // doing read means kernel will write to the buffer provided by user
-                return region->flags & RG_W;
-            } else if (operation == WRITE) {
-                return region->flags & RG_R;
-            }
+    as_region *region = vaddr_get_region(as, vaddr);
+    if (region && vaddr + size < region->vaddr + region->size) {
+        if (operation == READ) {
+            // doing read means kernel will write to the buffer provided by user
+            return region->flags & RG_W;
+        } else if (operation == WRITE) {
+            return region->flags & RG_R;
         }
-        region = region->next;
     }
     return false;
 }
@@ -268,13 +327,43 @@ bool validate_virtual_address(addrspace *as, seL4_Word vaddr, size_t size,
 
 as_region *vaddr_get_region(addrspace *as, seL4_Word vaddr)
 {
-    as_region *region = as->regions;
-    while (region) {
-        if (vaddr >= region->vaddr && vaddr < region->vaddr + region->size) {
-            return region;
-        }
-        region = region->next;
+    as_region *region = as->hint;
+    if (region && vaddr >= region->vaddr && vaddr < region->vaddr + region->size) {
+        return region;
+    }
+    int pos = index_find(as, vaddr);
+    if (pos < 0) {
+        return NULL;
+    }
+    region = as->index[pos];
+    if (vaddr < region->vaddr + region->size) {
+        as->hint = region;
+        return region;
     }
-
     return NULL;
-}
\ No newline at end of file
+}
+
+void as_region_resized(addrspace *as, as_region *region)
+{
+    int pos = index_find(as, region->vaddr);
+    while (pos >= 0 && as->index[pos] != region) {
+        pos--;
+    }
+    if (pos >= 0) {
+        gap_update(as, pos);
+    }
+}
+
+seL4_Word as_find_gap(addrspace *as, size_t size)
+{
+    if (as->nregions < 2 || as->gaps[1] <= size) {
+        return 0;
+    }
+    // down the leftmost subtree with room, the first fit by address
+    unsigned n = 1;
+    while (n < as->capacity) {
+        n = as->gaps[2 * n] > size ? 2 * n : 2 * n + 1;
+    }
+    as_region *region = as->index[n - as->capacity];
+    return ((region->vaddr + region->size) & PAGE_FRAME) + PAGE_SIZE_4K;
+}
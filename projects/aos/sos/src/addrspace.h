@@ -22,6 +22,8 @@ enum OPERATION {
 #define RG_W (1 << 1)
 #define RG_X (1 << 0)
 #define RG_OLD (1 << 4)
+/* anonymous memory which may be promoted to 2M pages */
+#define RG_LARGE (1 << 5)
 
 typedef struct proc proc;
 
@@ -40,7 +42,18 @@ typedef struct as_region {
 } as_region;
 
 typedef struct addrspace {
+    /* ordered by address, and the same regions in an array to search */
     as_region *regions;
+    as_region **index;
+    unsigned nregions;
+    unsigned capacity;
+    /*
+     * tournament tree of the largest free gap following each region of
+     * index, leaves from capacity on, so mmap finds the first fit quickly
+     */
+    seL4_Word *gaps;
+    /* the region the last lookup found, faults tend to stay in one */
+    as_region *hint;
     as_region *stack;
     as_region *heap;
     as_region *ipcbuffer;
@@ -71,3 +84,12 @@ bool validate_virtual_address(addrspace *as, seL4_Word vaddr, size_t size,
                               enum OPERATION operation);
 
 as_region *vaddr_get_region(addrspace *as, seL4_Word vaddr);
+
+/* the region's size changed in place, as brk does to the heap */
+void as_region_resized(addrspace *as, as_region *region);
+
+/*
+ * the lowest address past a region where size bytes fit before the next
+ * one, a guard page after the region below, or 0 if there is no such gap
+ */
+seL4_Word as_find_gap(addrspace *as, size_t size);
@@ -32,6 +32,15 @@
 #define INITIAL_TASK_CSPACE_SLOTS BIT(CNODE_SLOT_BITS(INITIAL_TASK_CNODE_SIZE_BITS) + \
                                       CNODE_SLOT_BITS(CNODE_SIZE_BITS))
 
+/* number of 2M untypeds to set aside for user large pages */
+#ifndef SOS_LARGE_PAGES
+#ifdef CONFIG_SOS_LARGE_PAGES
+#define SOS_LARGE_PAGES CONFIG_SOS_LARGE_PAGES
+#else
+#define SOS_LARGE_PAGES 2
+#endif
+#endif
+
 /* extra cspace info for the initial bootstrapped cspace */
 typedef struct {
     /* track the next free vaddr we have for mapping in frames
@@ -84,12 +93,15 @@ static seL4_CPtr steal_untyped(const seL4_BootInfo *bi, size_t size_bits, uintpt
 
     ZF_LOGD("looking for untyped %zu in size", size_bits);
     for (size_t i = 0; i < bi->untyped.end - bi->untyped.start; i++) {
-        if (boot_info_avail_bytes[i] >= BIT(size_bits)) {
+        /* the kernel aligns the retype to the object size, account for the gap */
+        size_t taken = BIT(bi->untypedList[i].sizeBits) - boot_info_avail_bytes[i];
+        size_t pad = ROUND_UP(taken, BIT(size_bits)) - taken;
+        if (!bi->untypedList[i].isDevice && boot_info_avail_bytes[i] >= BIT(size_bits) + pad) {
             if (paddr) {
                 *paddr = paddr_from_avail_bytes(bi, i, size_bits);
             }
             /* mark the bytes as unavailable */
-            boot_info_avail_bytes[i] -= BIT(size_bits);
+            boot_info_avail_bytes[i] -= BIT(size_bits) + pad;
             return i + bi->untyped.start;
         }
     }
@@ -205,6 +217,9 @@ void sos_bootstrap(cspace_t *cspace, const seL4_BootInfo *bi)
     /* 1 cptr for dma */
     n_slots++;
 
+    /* 1 cptr for each large page untyped */
+    n_slots += SOS_LARGE_PAGES;
+
     /* now work out the number of slots required to retype the untyped memory provided by
      * boot info into 4K untyped objects. We aren't going to initialise these objects yet,
      * but before we have bootstrapped the frame table we cannot allocate memory from it --
@@ -361,8 +376,29 @@ void sos_bootstrap(cspace_t *cspace, const seL4_BootInfo *bi)
     seL4_CPtr dma_cptr = first_free_slot;
     first_free_slot++;
 
+    /* and some 2M untypeds to back large pages, right after dma so the retypes
+     * happen in the same order as the steals */
+    seL4_CPtr large_cptrs[SOS_LARGE_PAGES];
+    uintptr_t large_paddrs[SOS_LARGE_PAGES];
+    size_t n_large = 0;
+    for (; n_large < SOS_LARGE_PAGES; n_large++) {
+        seL4_CPtr large_ut = steal_untyped(bi, seL4_LargePageBits, &large_paddrs[n_large]);
+        if (large_ut == seL4_CapNull) {
+            ZF_LOGW("Only found %zu untypeds for large pages", n_large);
+            break;
+        }
+        err = cspace_untyped_retype(cspace, large_ut, first_free_slot, seL4_UntypedObject,
+                                    seL4_LargePageBits);
+        ZF_LOGF_IFERR(err, "Failed to retype large page untyped");
+        large_cptrs[n_large] = first_free_slot;
+        first_free_slot++;
+    }
+
     /* initialise the ut table */
     ut_init((void *) SOS_UT_TABLE, memory);
+    for (size_t i = 0; i < n_large; i++) {
+        ut_add_large_untyped(large_paddrs[i], large_cptrs[i]);
+    }
 
     /* create all the 4K untypeds and build the ut table, from the first available empty slot */
     for (size_t i = 0; i < bi->untyped.end - bi->untyped.start; i++) {
@@ -0,0 +1,169 @@
+#include "dedup.h"
+#include "frametable.h"
+#include "pagetable.h"
+#include "proc.h"
+#include "vmstat.h"
+#include <autoconf.h>
+#include <clock/clock.h>
+#include <stdlib.h>
+#include <string.h>
+#include <picoro/picoro.h>
+
+/* pages the scanner looks at per second, 0 turns it off */
+#ifndef DEDUP_PAGES
+#ifdef CONFIG_SOS_DEDUP_PAGES
+#define DEDUP_PAGES CONFIG_SOS_DEDUP_PAGES
+#else
+#define DEDUP_PAGES 256
+#endif
+#endif
+/* the budget comes in small steps, so a busy SOS never owes a long scan */
+#define DEDUP_PERIOD_US 100000
+#define DEDUP_STEP MAX_UNSAFE(DEDUP_PAGES / 10, 1)
+/* stable pages by hash, a power of two */
+#define DEDUP_BUCKETS 1024
+
+static unsigned budget = 0;
+static unsigned cursor;
+/* hash of each frame's contents when the scanner last looked at it */
+static uint32_t *sums;
+/* frame + 1 of a stable page with each hash, checked again before it's used */
+static int buckets[DEDUP_BUCKETS];
+
+static void dedup_refill(UNUSED uint64_t id, UNUSED void *data)
+{
+    budget = DEDUP_STEP;
+}
+
+void dedup_init(void)
+{
+    if (DEDUP_PAGES == 0) {
+        return;
+    }
+    sums = calloc(frame_table.small, sizeof(uint32_t));
+    if (sums == NULL) {
+        ZF_LOGE("Out of memory for the dedup scanner");
+        return;
+    }
+    cursor = first_available_frame;
+    register_timer(DEDUP_PERIOD_US, dedup_refill, NULL, F, PERIODIC);
+}
+
+bool dedup_pending(void)
+{
+    return budget > 0;
+}
+
+static void *frame_addr(int frame)
+{
+    return (void *)(FRAME_BASE + PAGE_SIZE_4K * frame);
+}
+
+static uint32_t page_hash(int frame)
+{
+    const uint64_t *p = frame_addr(frame);
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned i = 0; i < PAGE_SIZE_4K / sizeof(uint64_t); ++i) {
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    }
+    return h ^ (h >> 32);
+}
+
+/* a user page the clock and everyone else leave alone right now */
+static bool candidate(int frame)
+{
+    return FRAME_GET_BIT(frame, MAPPED) && !FRAME_GET_BIT(frame, PIN)
+           && !FRAME_GET_BIT(frame, LARGE_FRAME)
+           && frame_table.frames[frame].refcount == frame_nmappers(frame);
+}
+
+static bool mapped_at(int pid, seL4_Word vaddr)
+{
+    seL4_Word entry = _get_frame_from_vaddr(get_process(pid)->pt, vaddr);
+    return (entry & PRESENT) && !(entry & UNMAPPED);
+}
+
+/* no fault on the frame can be half way through if every mapper has it mapped */
+static bool mapped_everywhere(int frame)
+{
+    if (!mapped_at(GET_PID(frame), frame_table.vaddr[frame])) {
+        return false;
+    }
+    for (frame_rmap *r = frame_table.rmap[frame]; r; r = r->next) {
+        if (!mapped_at(r->pid, r->vaddr)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * the only mapper of dup moves over to frame and dup is freed. everyone
+ * faults frame back in read-only, as it has more than one mapper now
+ */
+static void merge(int frame, int dup)
+{
+    proc *process = get_process(GET_PID(dup));
+    seL4_Word vaddr = frame_table.vaddr[dup];
+
+    if (frame_nmappers(frame) == 1) {
+        // its only mapper may still be writing to it
+        unmap_page(get_process(GET_PID(frame))->pt, frame_table.vaddr[frame]);
+    }
+    drop_page_cap(process->pt, vaddr);
+    frame_rmap_remove(dup, process->status.pid, vaddr);
+    frame_free(dup);
+    stage_page(process->pt, vaddr, frame);
+    frame_rmap_add(frame, process->status.pid, vaddr);
+    frame_ref(frame);
+    vmstat_events.dedup_merges++;
+}
+
+static void scan_one(void)
+{
+    if (cursor < first_available_frame || cursor >= (unsigned)frame_table.small) {
+        cursor = first_available_frame;
+    }
+    int frame = cursor++;
+    if (!candidate(frame)) {
+        return;
+    }
+    // only pages that didn't change since the last visit are worth merging
+    uint32_t sum = page_hash(frame);
+    bool stable = sums[frame] == sum;
+    sums[frame] = sum;
+    if (!stable) {
+        return;
+    }
+    unsigned b = sum & (DEDUP_BUCKETS - 1);
+    int other = buckets[b] - 1;
+    if (other == frame) {
+        return;
+    }
+    if (other < 0 || !candidate(other) || sums[other] != sum) {
+        buckets[b] = frame + 1;
+        return;
+    }
+    // the one with more mappers stays, the other must have a single one
+    int keep = frame_nmappers(other) >= frame_nmappers(frame) ? other : frame;
+    int dup = keep == frame ? other : frame;
+    if (frame_nmappers(dup) != 1 || !mapped_everywhere(keep) || !mapped_everywhere(dup)
+        || memcmp(frame_addr(keep), frame_addr(dup), PAGE_SIZE_4K)) {
+        return;
+    }
+    merge(keep, dup);
+    buckets[b] = keep + 1;
+}
+
+void *dedup_worker(void *arg)
+{
+    (void)arg;
+    while (1) {
+        if (budget) {
+            budget--;
+            scan_one();
+        }
+        yield(NULL);
+    }
+    return NULL;
+}
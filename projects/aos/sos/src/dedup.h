@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+
+/*
+ * background scanner merging identical user pages into one read-only frame.
+ * a frame is merged once its contents hashed the same on two visits in a
+ * row, and the sharing is broken again by the first write to it.
+ */
+
+/* start handing out scan budget, once the timer is up */
+void dedup_init(void);
+
+/* true while the scanner has budget left, it only runs when SOS is idle */
+bool dedup_pending(void);
+
+/* idle coroutine, looks at one frame per resume */
+void *dedup_worker(void *arg);
@@ -2,6 +2,9 @@
 #include "mapping.h"
 #include "pagetable.h"
 #include "proc.h"
+#include "replace.h"
+#include <autoconf.h>
+#include <picoro/picoro.h>
 #include <stdlib.h>
 
 #define UNTYPE_MEMEORY 0x1
@@ -9,25 +12,59 @@
 #define USED_MEMORY 0x3
 #define MEMORY_TYPE_MASK 0x3
 
-/* TODO: frame reference count */
+#define FRAME_SET_TYPE(x, type) (frame_table.frames[x].flag = \
+        (frame_table.frames[x].flag & ~MEMORY_TYPE_MASK) | (type))
 
-#define MOST_FREE 30
+/*
+ * free frames stay retyped and mapped in the pool until there are more
+ * than FRAME_POOL_HIGH_WATERMARK of them, then the pool is trimmed back
+ * down to FRAME_POOL_LOW_WATERMARK
+ */
+#ifndef FRAME_POOL_LOW_WATERMARK
+#ifdef CONFIG_SOS_FRAME_POOL_LOW
+#define FRAME_POOL_LOW_WATERMARK CONFIG_SOS_FRAME_POOL_LOW
+#else
+#define FRAME_POOL_LOW_WATERMARK 16
+#endif
+#endif
+
+#ifndef FRAME_POOL_HIGH_WATERMARK
+#ifdef CONFIG_SOS_FRAME_POOL_HIGH
+#define FRAME_POOL_HIGH_WATERMARK CONFIG_SOS_FRAME_POOL_HIGH
+#else
+#define FRAME_POOL_HIGH_WATERMARK 64
+#endif
+#endif
+
+/* how many victims frame_n_alloc may evict looking for a free block */
+#define FRAME_N_ALLOC_SWAPS 16
+
+/* how many pooled frames the idle worker keeps cleared for frame_alloc */
+#ifndef FRAME_ZERO_RESERVE
+#ifdef CONFIG_SOS_FRAME_ZERO_RESERVE
+#define FRAME_ZERO_RESERVE CONFIG_SOS_FRAME_ZERO_RESERVE
+#else
+#define FRAME_ZERO_RESERVE 8
+#endif
+#endif
 
 frame_table_t frame_table;
 static cspace_t *root_cspace;
 
 unsigned first_available_frame;
 
-unsigned th;
+static void free_to_untype(int frame);
+static void frame_pool_trim(int n);
 
-static ut_t *alloc_retype(seL4_CPtr *cptr, seL4_Word type)
+static ut_t *alloc_retype(seL4_CPtr *cptr, seL4_Word type, bool evict)
 {
     /* Allocate the object */
     // ut_t *ut = ut_alloc_4k_untyped(NULL);
     ut_t *ut;
-    // if(th > 2000){
     ut = ut_alloc_4k_untyped(NULL);
-    if (ut == NULL) {
+    if (ut == NULL && !evict) {
+        return NULL;
+    } else if (ut == NULL) {
         /* try page */
         seL4_Error err = try_swap_out();
         if (err == seL4_NoError) {
@@ -58,26 +95,120 @@ static ut_t *alloc_retype(seL4_CPtr *cptr, seL4_Word type)
     return ut;
 }
 
+/*
+ * Frame table indices which are not backed by a frame live in a binary buddy
+ * allocator. A free block of 2^order indices is listed under its first index
+ * in frame_table.untyped[order], linked through next/prev. Since FRAME_BASE is
+ * aligned, an aligned run of indices is also an aligned run in SOS's vspace.
+ */
+static void buddy_push(int page, int order)
+{
+    frame_table_obj *f = &frame_table.frames[page];
+    f->order = order;
+    f->prev = -1;
+    f->next = frame_table.untyped[order];
+    if (f->next != -1) {
+        frame_table.frames[f->next].prev = page;
+    }
+    frame_table.untyped[order] = page;
+    FRAME_SET_TYPE(page, UNTYPE_MEMEORY);
+}
+
+static void buddy_unlink(int page, int order)
+{
+    frame_table_obj *f = &frame_table.frames[page];
+    if (f->prev != -1) {
+        frame_table.frames[f->prev].next = f->next;
+    } else {
+        frame_table.untyped[order] = f->next;
+    }
+    if (f->next != -1) {
+        frame_table.frames[f->next].prev = f->prev;
+    }
+}
+
+/* take a block of 2^order unbacked indices, -1 if there is none */
+static int buddy_alloc(int order)
+{
+    int o = order;
+    while (o <= FRAME_MAX_ORDER && frame_table.untyped[o] == -1) {
+        o++;
+    }
+    if (o > FRAME_MAX_ORDER) {
+        return -1;
+    }
+    int page = frame_table.untyped[o];
+    buddy_unlink(page, o);
+    /* split it down, the upper halves go back on the lower lists */
+    while (o > order) {
+        o--;
+        buddy_push(page + BIT(o), o);
+    }
+    for (int i = 0; i < (int)BIT(order); ++i) {
+        FRAME_SET_TYPE(page + i, USED_MEMORY);
+    }
+    return page;
+}
+
+/* give back a single unbacked index, merging with its buddies */
+static void buddy_free(int page)
+{
+    int order = 0;
+    while (order < FRAME_MAX_ORDER) {
+        int buddy = page ^ BIT(order);
+        /* a free block head is always entirely inside the index space */
+        if (buddy >= frame_table.length
+                || (frame_table.frames[buddy].flag & MEMORY_TYPE_MASK) != UNTYPE_MEMEORY
+                || frame_table.frames[buddy].order != order) {
+            break;
+        }
+        buddy_unlink(buddy, order);
+        page = MIN(page, buddy);
+        order++;
+    }
+    buddy_push(page, order);
+}
+
 void initialize_frame_table(cspace_t *cspace)
 {
     ut_t *ut;
     root_cspace = cspace;
     seL4_Word vaddr = FRAME_BASE;
-    frame_table.frames = (frame_table_obj *)FRAME_BASE;
     // the number of pages of all untyped memeory
     size_t n_frames = ut_size() / PAGE_SIZE_4K;
     if(n_frames > MAX_MEM / PAGE_SIZE_4K){
         n_frames = MAX_MEM / PAGE_SIZE_4K;
     }
+    /* large frames get their own aligned slots of indices past the small ones,
+     * so SOS never has a page table where it maps one */
+    size_t n_small = n_frames;
+    size_t large_base = ROUND_UP(n_small, FRAME_LARGE_PAGES);
+    if (ut_n_large_untyped() > 0) {
+        n_frames = large_base + ut_n_large_untyped() * FRAME_LARGE_PAGES;
+    }
 
     frame_table.length = (int)n_frames;
-    // the number of pages consumed by frame table
-    size_t n_pages = (n_frames * sizeof(frame_table_obj) + PAGE_SIZE_4K - 1) /
+    frame_table.small = (int)n_small;
+    // the number of pages consumed by frame table and its arrays. backing
+    // comes first, entry i of it is on a page at most i, so the pages can
+    // be noted down as they are mapped one by one
+    size_t n_words = FRAME_BITMAP_WORDS(n_frames);
+    size_t n_pages = (n_frames * (sizeof(frame_backing) + sizeof(frame_table_obj) +
+                                  sizeof(seL4_Word) + sizeof(frame_rmap *) +
+                                  sizeof(unsigned) + sizeof(uint8_t)) +
+                      2 * n_words * sizeof(unsigned long) + PAGE_SIZE_4K - 1) /
                      PAGE_SIZE_4K;
-    frame_table.untyped = (uint32_t)n_pages;
+    frame_table.backing = (frame_backing *)FRAME_BASE;
+    frame_table.frames = (frame_table_obj *)(frame_table.backing + n_frames);
+    frame_table.vaddr = (seL4_Word *)(frame_table.frames + n_frames);
+    frame_table.rmap = (frame_rmap **)(frame_table.vaddr + n_frames);
+    frame_table.pin = (unsigned long *)(frame_table.rmap + n_frames);
+    frame_table.clock = frame_table.pin + n_words;
+    frame_table.slot = (unsigned *)(frame_table.clock + n_words);
+    frame_table.ref_sweep = (uint8_t *)(frame_table.slot + n_frames);
     for (size_t i = 0; i < n_pages; ++i) {
         seL4_CPtr frame_cap;
-        ut = alloc_retype(&frame_cap, seL4_ARM_SmallPageObject);
+        ut = alloc_retype(&frame_cap, seL4_ARM_SmallPageObject, true);
         if (ut == NULL) {
             return;
         }
@@ -85,172 +216,571 @@ void initialize_frame_table(cspace_t *cspace)
         map_frame(cspace, frame_cap, seL4_CapInitThreadVSpace,
                   vaddr, seL4_AllRights, seL4_ARM_Default_VMAttributes);
         // ZF_LOGF_IFERR(err, "Failed to map frame table pages");
-        frame_table.frames[i].ut = ut;
+        frame_table.backing[i].ut = ut;
+        frame_table.backing[i].frame_cap = frame_cap;
+        vaddr += PAGE_SIZE_4K;
+    }
+    /* the other arrays are only all there once every page is */
+    for (size_t i = 0; i < n_pages; ++i) {
         frame_table.frames[i].next = -1;
+        frame_table.frames[i].nframes = 1;
         frame_table.frames[i].flag = USED_MEMORY;
-        frame_table.frames[i].frame_cap = frame_cap;
         FRAME_SET_BIT(i, PIN);
-        vaddr += PAGE_SIZE_4K;
     }
     // printf("initial frametable done part I\n");
     // printf("there is %lu frames\nframetable n_pages %lu\n", n_frames, n_pages);
     first_available_frame = n_pages;
+    for (int o = 0; o <= FRAME_MAX_ORDER; ++o) {
+        frame_table.untyped[o] = -1;
+    }
     for (size_t i = n_pages; i < n_frames; ++i) {
-        frame_table.frames[i].ut = NULL;
-        frame_table.frames[i].next = i + 1;
-        frame_table.frames[i].flag = UNTYPE_MEMEORY;
+        frame_table.backing[i].ut = NULL;
+        frame_table.rmap[i] = NULL;
+        frame_table.slot[i] = 0;
+        frame_table.frames[i].order = 0;
+        frame_table.frames[i].flag = i < n_small ? UNTYPE_MEMEORY : USED_MEMORY;
         FRAME_SET_BIT(i, PIN);
     }
-    // the final frame will link back to itself
-    frame_table.frames[n_frames - 1].next = n_frames - 1;
-    /* we are using water mark, so there is no free frame at first */
-    // frame_table.free = -1;
+    /* carve the rest of the index space into the largest aligned blocks */
+    for (size_t i = n_pages; i < n_small;) {
+        int order = FRAME_MAX_ORDER;
+        while (!IS_ALIGNED(i, order) || i + BIT(order) > n_small) {
+            order--;
+        }
+        buddy_push(i, order);
+        i += BIT(order);
+    }
+    frame_table.large = -1;
+    frame_table.num_large = 0;
+    for (size_t i = n_frames; i > n_small; i -= FRAME_LARGE_PAGES) {
+        size_t page = i - FRAME_LARGE_PAGES;
+        frame_table.frames[page].next = frame_table.large;
+        frame_table.large = page;
+        frame_table.num_large++;
+    }
+    /* the free pool starts empty and fills up as frames are freed */
+    frame_table.free = -1;
+    frame_table.num_frees = 0;
+    frame_table.zeroed = -1;
+    frame_table.num_zeroed = 0;
+    frame_table.zero_hits = 0;
+    frame_table.pool_hits = 0;
+    frame_table.pool_misses = 0;
+    frame_table.num_tables = 0;
     frame_table.max = n_frames - n_pages + 1;
     // printf("initial frametable done part II\n");
     return;
 }
 
-int frame_alloc(seL4_Word *vaddr)
+/* pop the head of one of the pool lists, -1 if the list is empty */
+static int pool_pop(int *list, int *count)
 {
-    seL4_Word _vaddr;
-    int page = frame_table.untyped;
+    int page = *list;
+    if (page != -1) {
+        *list = frame_table.frames[page].next;
+        (*count)--;
+    }
+    return page;
+}
 
-    if(page * PAGE_SIZE_4K >= MAX_MEM - 4096){
-        // hit memory max
-        try_swap_out();
-        page = frame_table.untyped;
-        if(page * PAGE_SIZE_4K >= MAX_MEM - 4096){
-            // still hit memory max means we run out of memory for user
-            return -1;
+void *frame_zero_worker(void *arg)
+{
+    (void)arg;
+    while (1) {
+        if (frame_zero_pending()) {
+            int page = pool_pop(&frame_table.free, &frame_table.num_frees);
+            memset((void *)(page * PAGE_SIZE_4K + FRAME_BASE), 0, PAGE_SIZE_4K);
+            frame_table.frames[page].next = frame_table.zeroed;
+            frame_table.zeroed = page;
+            frame_table.num_zeroed++;
         }
+        yield(NULL);
     }
+    return NULL;
+}
 
-    // watermark is disabled
-    // if (page > 0) {
-    //     /* we got a free frame, just use it */
-    //     _vaddr = page * PAGE_SIZE_4K + FRAME_BASE;
-    //     frame_table.free = frame_table.frames[page].next;
-    //     frame_table.num_frees--;
-    //     memset((void *)_vaddr, 0, PAGE_SIZE_4K);
-    //     frame_table.frames[page].next = -1;
-    //     if (vaddr) {
-    //         *vaddr = _vaddr;
-    //     }
-
-    //     FRAME_SET_BIT(page, PIN);
-    //     if(page > frame_table.max){
-    //         frame_table.max = page;
-    //     }
-    //     return page;
-    // }
-
-    /* otherwise we need to get one from untyped mem */
+/* back an index handed out by buddy_alloc with a new frame mapped into SOS */
+static int frame_back(int page, bool evict)
+{
     seL4_CPtr frame_cap;
-    _vaddr = 0;
     /* always try to get mem from ut_table */
-    ut_t *ut = alloc_retype(&frame_cap, seL4_ARM_SmallPageObject);
+    ut_t *ut = alloc_retype(&frame_cap, seL4_ARM_SmallPageObject, evict);
     if (ut == NULL) {
         // out of memory
-        if (vaddr != NULL) {
-            *vaddr = _vaddr;
-        }
         return -1;
     }
-    page = frame_table.untyped;
-    assert(page != -1);
-    _vaddr = page * PAGE_SIZE_4K + FRAME_BASE;
     seL4_Error err = map_frame(root_cspace, frame_cap, seL4_CapInitThreadVSpace,
-                               _vaddr, seL4_AllRights, seL4_ARM_Default_VMAttributes);
-
+                               page * PAGE_SIZE_4K + FRAME_BASE, seL4_AllRights,
+                               seL4_ARM_Default_VMAttributes);
     if (err != seL4_NoError) {
-        cspace_delete(global_cspace, frame_cap);
-        cspace_free_slot(global_cspace, frame_cap);
+        cspace_delete(root_cspace, frame_cap);
+        cspace_free_slot(root_cspace, frame_cap);
         ut_free(ut, seL4_PageBits);
-        return 0;
+        return -1;
     }
 
-    frame_table.frames[page].ut = ut;
-    frame_table.frames[page].flag |= USED_MEMORY;
-    frame_table.frames[page].frame_cap = frame_cap;
-    frame_table.untyped = frame_table.frames[page].next;
-
-
+    /* a freshly retyped frame has already been cleared by the kernel */
+    frame_table.backing[page].ut = ut;
+    frame_table.backing[page].frame_cap = frame_cap;
     frame_table.frames[page].next = -1;
-    memset((void *)_vaddr, 0, PAGE_SIZE_4K);
-    if (vaddr) {
-        *vaddr = _vaddr;
-    }
+    frame_table.frames[page].nframes = 1;
+    frame_table.frames[page].refcount = 1;
+    FRAME_SET_TYPE(page, USED_MEMORY);
     FRAME_SET_BIT(page, PIN);
     if (page > frame_table.max) {
         frame_table.max = page;
     }
+    return 0;
+}
+
+static int _frame_alloc(seL4_Word *vaddr, bool zero, bool evict)
+{
+    int page;
+
+    /*
+     * callers that want a clean page take the zeroed reserve first,
+     * everyone else takes a dirty frame and leaves the reserve alone
+     */
+    if (zero) {
+        page = pool_pop(&frame_table.zeroed, &frame_table.num_zeroed);
+        if (page != -1) {
+            frame_table.zero_hits++;
+        } else {
+            page = pool_pop(&frame_table.free, &frame_table.num_frees);
+            if (page != -1) {
+                memset((void *)(page * PAGE_SIZE_4K + FRAME_BASE), 0, PAGE_SIZE_4K);
+            }
+        }
+    } else {
+        page = pool_pop(&frame_table.free, &frame_table.num_frees);
+        if (page == -1) {
+            page = pool_pop(&frame_table.zeroed, &frame_table.num_zeroed);
+        }
+    }
+
+    if (page != -1) {
+        /* we got a free frame, it is still retyped and mapped, just use it */
+        frame_table.pool_hits++;
+        frame_table.frames[page].next = -1;
+        frame_table.frames[page].nframes = 1;
+        frame_table.frames[page].refcount = 1;
+        FRAME_SET_TYPE(page, USED_MEMORY);
+        FRAME_SET_BIT(page, PIN);
+        if (page > frame_table.max) {
+            frame_table.max = page;
+        }
+    } else {
+        frame_table.pool_misses++;
+        /* otherwise we need to get one from untyped mem */
+        page = buddy_alloc(0);
+        if (page == -1 && evict) {
+            // hit memory max
+            try_swap_out();
+            page = buddy_alloc(0);
+            if (page == -1) {
+                // still hit memory max means we run out of memory for user
+                return -1;
+            }
+        } else if (page == -1) {
+            return -1;
+        }
+        if (frame_back(page, evict)) {
+            buddy_free(page);
+            return -1;
+        }
+    }
+
+    if (vaddr) {
+        *vaddr = page * PAGE_SIZE_4K + FRAME_BASE;
+    }
     return page;
 }
 
+int frame_alloc(seL4_Word *vaddr)
+{
+    return _frame_alloc(vaddr, true, true);
+}
+
+int frame_alloc_nozero(seL4_Word *vaddr)
+{
+    return _frame_alloc(vaddr, false, true);
+}
+
+int frame_alloc_noevict(seL4_Word *vaddr)
+{
+    return _frame_alloc(vaddr, false, false);
+}
+
+int frame_alloc_prezeroed(seL4_Word *vaddr)
+{
+    if (frame_table.num_zeroed == 0) {
+        return -1;
+    }
+    return _frame_alloc(vaddr, true, false);
+}
+
 int frame_n_alloc(seL4_Word *vaddr, int nframes)
 {
-    int base_frame = frame_alloc(vaddr);
-    int frame = 0, tmp = 0;
-    if (base_frame == -1 || base_frame == 0)
+    int order = 0;
+    while ((int)BIT(order) < nframes) {
+        order++;
+    }
+    assert(order <= FRAME_MAX_ORDER);
+
+    if (nframes == 1) {
+        /* a single frame comes from the pool like any other, the zeroed
+         * reserve first, and only needs a retype when the pool is empty */
+        int page = _frame_alloc(vaddr, true, true);
+        if (page != -1) {
+            frame_table.num_tables++;
+        }
+        return page;
+    }
+
+    int base_frame = buddy_alloc(order);
+    /* pooled frames pin single indices, let them merge back first */
+    if (base_frame == -1) {
+        frame_pool_trim(0);
+        base_frame = buddy_alloc(order);
+    }
+    for (int i = 0; base_frame == -1 && i < FRAME_N_ALLOC_SWAPS; ++i) {
+        if (try_swap_out() != seL4_NoError) {
+            break;
+        }
+        base_frame = buddy_alloc(order);
+    }
+    if (base_frame == -1) {
         return -1;
-    frame = base_frame;
-    for (int i = 1; i < nframes; ++i) {
-        frame_table.frames[frame].next = frame_alloc(NULL);
-        if (frame_table.frames[frame].next == -1
-                || frame_table.frames[frame].next == 0) {
+    }
+    /* hand back the part of the block we don't need */
+    for (int i = nframes; i < (int)BIT(order); ++i) {
+        buddy_free(base_frame + i);
+    }
+
+    for (int i = 0; i < nframes; ++i) {
+        if (frame_back(base_frame + i, true)) {
             // out of memory need clean up all pre-allocated frames
-            tmp = base_frame;
-            while (tmp != -1) {
-                frame = frame_table.frames[tmp].next;
-                frame_free(tmp);
-                tmp = frame;
+            for (int j = 0; j < i; ++j) {
+                free_to_untype(base_frame + j);
+            }
+            for (int j = i; j < nframes; ++j) {
+                buddy_free(base_frame + j);
             }
             return -1;
         }
-        frame = frame_table.frames[frame].next;
+    }
+    frame_table.frames[base_frame].nframes = nframes;
+    frame_table.num_tables += nframes;
+    if (vaddr) {
+        *vaddr = base_frame * PAGE_SIZE_4K + FRAME_BASE;
     }
     return base_frame;
 }
 
 void frame_n_free(int frames)
 {
-    int frame = 0, tmp = frames;
-    while (tmp != -1) {
-        frame = frame_table.frames[tmp].next;
-        frame_free(tmp);
-        tmp = frame;
+    int nframes = frame_table.frames[frames].nframes;
+    frame_table.num_tables -= nframes;
+    for (int i = 0; i < nframes; ++i) {
+        frame_free(frames + i);
+    }
+}
+
+int frame_large_alloc(seL4_Word *vaddr)
+{
+    int page = frame_table.large;
+    if (page == -1) {
+        return -1;
+    }
+    ut_t *ut = ut_alloc_large_untyped(NULL);
+    if (ut == NULL) {
+        return -1;
+    }
+    seL4_CPtr frame_cap = cspace_alloc_slot(root_cspace);
+    if (frame_cap == seL4_CapNull) {
+        ut_free(ut, seL4_LargePageBits);
+        return -1;
+    }
+    seL4_Error err = cspace_untyped_retype(root_cspace, ut->cap, frame_cap,
+                                           seL4_ARM_LargePageObject, seL4_LargePageBits);
+    if (err != seL4_NoError) {
+        cspace_free_slot(root_cspace, frame_cap);
+        ut_free(ut, seL4_LargePageBits);
+        return -1;
+    }
+    err = map_frame(root_cspace, frame_cap, seL4_CapInitThreadVSpace,
+                    page * PAGE_SIZE_4K + FRAME_BASE, seL4_AllRights,
+                    seL4_ARM_Default_VMAttributes);
+    if (err != seL4_NoError) {
+        cspace_delete(root_cspace, frame_cap);
+        cspace_free_slot(root_cspace, frame_cap);
+        ut_free(ut, seL4_LargePageBits);
+        return -1;
+    }
+
+    frame_table.large = frame_table.frames[page].next;
+    frame_table.num_large--;
+    frame_table.backing[page].ut = ut;
+    frame_table.backing[page].frame_cap = frame_cap;
+    frame_table.frames[page].next = -1;
+    frame_table.frames[page].nframes = 1;
+    frame_table.frames[page].refcount = 1;
+    FRAME_SET_BIT(page, LARGE_FRAME);
+    FRAME_SET_BIT(page, PIN);
+    if (page > frame_table.max) {
+        frame_table.max = page;
+    }
+    if (vaddr) {
+        *vaddr = page * PAGE_SIZE_4K + FRAME_BASE;
+    }
+    return page;
+}
+
+/* a mapper came or went, keep its resident set size in step */
+static void rss_account(int pid, int delta)
+{
+    proc *process = get_process(pid);
+    if (delta < 0 && process->rss < (unsigned)-delta) {
+        process->rss = 0;
+    } else {
+        process->rss += delta;
     }
 }
 
+/* forget every mapper, the frame is going away */
+static void frame_rmap_clear(int frame)
+{
+    frame_rmap *r = frame_table.rmap[frame];
+    if (FRAME_GET_BIT(frame, PREFETCH)) {
+        /* read in ahead of time and never touched */
+        FRAME_CLEAR_BIT(frame, PREFETCH);
+        prefetch_wasted(get_process(frame_table.frames[frame].pid));
+    }
+    if (FRAME_GET_BIT(frame, MAPPED)) {
+        rss_account(frame_table.frames[frame].pid, -1);
+    }
+    while (r) {
+        frame_rmap *next = r->next;
+        rss_account(r->pid, -1);
+        free(r);
+        r = next;
+    }
+    frame_table.rmap[frame] = NULL;
+    frame_table.vaddr[frame] = 0;
+    frame_table.frames[frame].refcount = 0;
+    FRAME_CLEAR_BIT(frame, MAPPED);
+}
+
+void frame_large_free(int frame)
+{
+    assert(FRAME_GET_BIT(frame, LARGE_FRAME));
+    seL4_ARM_Page_Unmap(frame_table.backing[frame].frame_cap);
+    cspace_delete(root_cspace, frame_table.backing[frame].frame_cap);
+    cspace_free_slot(root_cspace, frame_table.backing[frame].frame_cap);
+    ut_free(frame_table.backing[frame].ut, seL4_LargePageBits);
+    frame_table.backing[frame].ut = NULL;
+    frame_table.backing[frame].frame_cap = 0;
+    for (int i = 0; i < FRAME_LARGE_PAGES; ++i) {
+        frame_rmap_clear(frame + i);
+    }
+    FRAME_CLEAR_BIT(frame, LARGE_FRAME);
+    FRAME_CLEAR_BIT(frame, CLOCK);
+    FRAME_SET_BIT(frame, PIN);
+    replace_forget(frame);
+    frame_table.frames[frame].next = frame_table.large;
+    frame_table.large = frame;
+    frame_table.num_large++;
+}
+
 static void free_to_untype(int frame)
 {
     /* ut_free this frame */
-    seL4_ARM_Page_Unmap(frame_table.frames[frame].frame_cap);
-    cspace_delete(root_cspace, frame_table.frames[frame].frame_cap);
-    cspace_free_slot(root_cspace, frame_table.frames[frame].frame_cap);
-    ut_free(frame_table.frames[frame].ut, seL4_PageBits);
-    frame_table.frames[frame].ut = NULL;
-    frame_table.frames[frame].frame_cap = 0;
-    frame_table.frames[frame].flag |= UNTYPE_MEMEORY;
-    frame_table.frames[frame].vaddr = 0;
-    /* set this frame to untyped list */
-    frame_table.frames[frame].next = frame_table.untyped;
-    assert(frame_table.untyped != -1);
-    frame_table.untyped = frame;
-    frame_table.num_frees--;
+    seL4_ARM_Page_Unmap(frame_table.backing[frame].frame_cap);
+    cspace_delete(root_cspace, frame_table.backing[frame].frame_cap);
+    cspace_free_slot(root_cspace, frame_table.backing[frame].frame_cap);
+    ut_free(frame_table.backing[frame].ut, seL4_PageBits);
+    frame_table.backing[frame].ut = NULL;
+    frame_table.backing[frame].frame_cap = 0;
+    frame_table.vaddr[frame] = 0;
+    /* give the index back to the buddy allocator */
+    buddy_free(frame);
+}
+
+/*
+ * hand pooled frames back to untyped until only n are left,
+ * dirty frames go first so the zeroed reserve survives a trim
+ */
+static void frame_pool_trim(int n)
+{
+    while (frame_table.num_frees + frame_table.num_zeroed > n) {
+        int frame = pool_pop(&frame_table.free, &frame_table.num_frees);
+        if (frame == -1) {
+            frame = pool_pop(&frame_table.zeroed, &frame_table.num_zeroed);
+        }
+        free_to_untype(frame);
+    }
+}
+
+bool frame_pool_reclaim(void)
+{
+    int n = frame_table.num_frees + frame_table.num_zeroed;
+    if (n == 0) {
+        return false;
+    }
+    frame_pool_trim(n - 1);
+    return true;
+}
+
+bool frame_zero_pending(void)
+{
+    return frame_table.num_frees > 0 && frame_table.num_zeroed < FRAME_ZERO_RESERVE;
+}
+
+void frame_rmap_add(int frame, int pid, seL4_Word vaddr)
+{
+    frame_table_obj *f = &frame_table.frames[frame];
+    if (!FRAME_GET_BIT(frame, MAPPED)) {
+        f->pid = pid;
+        frame_table.vaddr[frame] = vaddr;
+        FRAME_SET_BIT(frame, MAPPED);
+        rss_account(pid, 1);
+        return;
+    }
+    /* remapping after the clock took the mapping away */
+    if (f->pid == (uint8_t)pid && frame_table.vaddr[frame] == vaddr) {
+        return;
+    }
+    for (frame_rmap *r = frame_table.rmap[frame]; r; r = r->next) {
+        if (r->pid == (uint8_t)pid && r->vaddr == vaddr) {
+            return;
+        }
+    }
+    frame_rmap *r = malloc(sizeof(frame_rmap));
+    if (r == NULL) {
+        ZF_LOGE("Out of memory for frame %d rmap", frame);
+        return;
+    }
+    r->pid = pid;
+    r->vaddr = vaddr;
+    r->next = frame_table.rmap[frame];
+    frame_table.rmap[frame] = r;
+    rss_account(pid, 1);
+}
+
+void frame_rmap_remove(int frame, int pid, seL4_Word vaddr)
+{
+    frame_table_obj *f = &frame_table.frames[frame];
+    if (!FRAME_GET_BIT(frame, MAPPED)) {
+        return;
+    }
+    if (f->pid == (uint8_t)pid && frame_table.vaddr[frame] == vaddr) {
+        rss_account(pid, -1);
+        /* the next mapper moves inline */
+        frame_rmap *r = frame_table.rmap[frame];
+        if (r == NULL) {
+            FRAME_CLEAR_BIT(frame, MAPPED);
+            return;
+        }
+        f->pid = r->pid;
+        frame_table.vaddr[frame] = r->vaddr;
+        frame_table.rmap[frame] = r->next;
+        free(r);
+        return;
+    }
+    for (frame_rmap **r = &frame_table.rmap[frame]; *r; r = &(*r)->next) {
+        if ((*r)->pid == (uint8_t)pid && (*r)->vaddr == vaddr) {
+            frame_rmap *tmp = *r;
+            rss_account(pid, -1);
+            *r = tmp->next;
+            free(tmp);
+            return;
+        }
+    }
+}
+
+int frame_nmappers(int frame)
+{
+    int n = FRAME_GET_BIT(frame, MAPPED);
+    for (frame_rmap *r = frame_table.rmap[frame]; r; r = r->next) {
+        n++;
+    }
+    return n;
+}
+
+void frame_ref(int frame)
+{
+    assert(frame_table.frames[frame].refcount > 0);
+    frame_table.frames[frame].refcount++;
+}
+
+void frame_recycle(int frame)
+{
+    FRAME_SET_BIT(frame, PIN);
+    FRAME_CLEAR_BIT(frame, CLOCK);
+    replace_forget(frame);
+    swap_cache_drop(frame);
+    frame_rmap_clear(frame);
+    frame_table.frames[frame].refcount = 1;
+}
+
+void frame_release(int frame)
+{
+    if (frame < 0 || frame >= frame_table.length)
+        assert(false);
+    frame_recycle(frame);
+    free_to_untype(frame);
 }
 
 void frame_free(int frame)
 {
     if (frame < 0 || frame >= frame_table.length)
         assert(false);
-    // frame_table.frames[frame].next = frame_table.free;
-    // frame_table.frames[frame].flag = FREE_MEMORY;
-    // frame_table.free = frame;
-    // frame_table.num_frees++;
+    /* somebody else still has it */
+    if (frame_table.frames[frame].refcount > 1) {
+        frame_table.frames[frame].refcount--;
+        return;
+    }
+    /* keep the frame retyped and mapped, the next frame_alloc takes it back */
     FRAME_SET_BIT(frame, PIN);
-    // if (frame_table.num_frees >= MOST_FREE) {
-    // printf("try to real free\n");
-    free_to_untype(frame);
-    // }
-}
\ No newline at end of file
+    FRAME_CLEAR_BIT(frame, CLOCK);
+    FRAME_SET_TYPE(frame, FREE_MEMORY);
+    replace_forget(frame);
+    swap_cache_drop(frame);
+    frame_rmap_clear(frame);
+    frame_table.frames[frame].next = frame_table.free;
+    frame_table.free = frame;
+    frame_table.num_frees++;
+    if (frame_table.num_frees + frame_table.num_zeroed > FRAME_POOL_HIGH_WATERMARK) {
+        frame_pool_trim(FRAME_POOL_LOW_WATERMARK);
+    }
+}
+
+void frame_table_stat(sos_vmstat_t *stat)
+{
+    stat->frames = frame_table.small - first_available_frame;
+    stat->untyped = 0;
+    stat->used = 0;
+    stat->pinned = 0;
+    stat->shared = 0;
+    for (int i = first_available_frame; i < frame_table.small; ++i) {
+        switch (frame_table.frames[i].flag & MEMORY_TYPE_MASK) {
+        case UNTYPE_MEMEORY:
+            stat->untyped++;
+            break;
+        case USED_MEMORY:
+            if (FRAME_GET_BIT(i, PIN)) {
+                stat->pinned++;
+            } else {
+                stat->used++;
+            }
+            if (FRAME_GET_BIT(i, MAPPED)) {
+                stat->shared += frame_nmappers(i) - 1;
+            }
+            break;
+        }
+    }
+    stat->pooled = frame_table.num_frees + frame_table.num_zeroed;
+    stat->zeroed = frame_table.num_zeroed;
+    stat->page_tables = frame_table.num_tables;
+    stat->large = ut_n_large_untyped() - frame_table.num_large;
+}
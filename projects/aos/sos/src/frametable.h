@@ -1,36 +1,116 @@
 #pragma once
 
 #include "ut.h"
+#include "vmstat.h"
 #include <cspace/cspace.h>
 #include <sel4/sel4.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <limits.h>
 
 #define FRAME_BASE 0xA000000000
 #define MAX_MEM (8 * 1024 * 1024)
 
 #define PIN 3
 #define CLOCK 4
-#define FRAME_SET_BIT(x, bit) (frame_table.frames[x].flag |= (1 << bit))
-#define FRAME_CLEAR_BIT(x, bit) (frame_table.frames[x].flag &= ~(1 << bit))
-#define FRAME_GET_BIT(x, bit) (((frame_table.frames[x].flag >> bit) & 1u) )
+/* set on the first index of a 2M frame, the rest of its indices stay pinned */
+#define LARGE_FRAME 5
+/* pid / vaddr of the frame hold a mapper, more mappers are on rmap */
+#define MAPPED 6
+/* read in by swap read-around and not faulted on yet */
+#define PREFETCH 7
+/* 4K indices covered by one large frame */
+#define FRAME_LARGE_PAGES BIT(seL4_LargePageBits - seL4_PageBits)
+/*
+ * PIN and CLOCK are what the clock looks at for every frame, so they live
+ * in dense bitmaps instead of the flag byte of each frame_table_obj
+ */
+#define FRAME_WORD_BITS (sizeof(unsigned long) * CHAR_BIT)
+#define FRAME_BITMAP_WORDS(n) (((n) + FRAME_WORD_BITS - 1) / FRAME_WORD_BITS)
+#define FRAME_HOT_BIT(bit) ((bit) == PIN || (bit) == CLOCK)
+#define FRAME_BITMAP(bit) ((bit) == PIN ? frame_table.pin : frame_table.clock)
+#define FRAME_BITMAP_WORD(x, bit) (FRAME_BITMAP(bit)[(x) / FRAME_WORD_BITS])
+#define FRAME_BITMAP_MASK(x) (1ul << ((x) % FRAME_WORD_BITS))
+#define FRAME_SET_BIT(x, bit) (FRAME_HOT_BIT(bit) ? \
+    (void)(FRAME_BITMAP_WORD(x, bit) |= FRAME_BITMAP_MASK(x)) : \
+    (void)(frame_table.frames[x].flag |= (1 << bit)))
+#define FRAME_CLEAR_BIT(x, bit) (FRAME_HOT_BIT(bit) ? \
+    (void)(FRAME_BITMAP_WORD(x, bit) &= ~FRAME_BITMAP_MASK(x)) : \
+    (void)(frame_table.frames[x].flag &= ~(1 << bit)))
+#define FRAME_GET_BIT(x, bit) (FRAME_HOT_BIT(bit) ? \
+    (unsigned)((FRAME_BITMAP_WORD(x, bit) >> ((x) % FRAME_WORD_BITS)) & 1u) : \
+    (unsigned)((frame_table.frames[x].flag >> bit) & 1u))
 #define SET_PID(x, p) (frame_table.frames[x].pid = p)
 #define GET_PID(x) (frame_table.frames[x].pid)
 
+/* largest block handed out by frame_n_alloc is 2^FRAME_MAX_ORDER frames */
+#define FRAME_MAX_ORDER 3
+
+/* reverse map entry for each process mapping a frame past the first one */
+typedef struct frame_rmap {
+    struct frame_rmap *next;
+    seL4_Word vaddr;
+    uint8_t pid;
+} frame_rmap;
+
+/*
+ * what the allocator and the clock look at for every frame. the rest of the
+ * per frame state is kept apart in the parallel arrays of frame_table, so a
+ * scan over the frames stays within these few dense bytes each
+ */
 typedef struct frame_table_obj {
-    ut_t *ut;
     int next;
-    seL4_CPtr frame_cap;
+    /* back link while the index sits on a buddy free list */
+    int prev;
     uint8_t flag;
     uint8_t pid;
-    seL4_Word vaddr;
+    /* buddy order of a free block, frames in a frame_n_alloc run */
+    uint8_t order;
+    uint8_t nframes;
+    /* references held on the frame, it is freed when the last one drops */
+    uint16_t refcount;
 } frame_table_obj;
 
+/* the untyped and cap behind a frame, only needed to back or release it */
+typedef struct frame_backing {
+    ut_t *ut;
+    seL4_CPtr frame_cap;
+} frame_backing;
+
 typedef struct frame_table {
+    /* the free pool is split into dirty (free) and already cleared frames */
     int free;
-    int untyped;
+    int zeroed;
+    /* buddy free lists of unbacked indices, one per order */
+    int untyped[FRAME_MAX_ORDER + 1];
+    /* free large frame slots, linked through next of their first index */
+    int large;
+    int num_large;
     int num_frees;
+    int num_zeroed;
+    /* frame_alloc served from / missed the free pool */
+    unsigned long pool_hits;
+    unsigned long pool_misses;
+    /* frame_alloc served from the zeroed reserve */
+    unsigned long zero_hits;
+    /* frames backing shadow page tables */
+    int num_tables;
     frame_table_obj *frames;
+    /* indexed like frames, the table is these arrays one after the other */
+    frame_backing *backing;
+    /* the process address of the first mapper */
+    seL4_Word *vaddr;
+    frame_rmap **rmap;
+    /* one bit per frame */
+    unsigned long *pin;
+    unsigned long *clock;
+    /* swap slot + 1 still holding the same data as a clean frame, or 0 */
+    unsigned *slot;
+    /* clock sweep that last found the frame referenced */
+    uint8_t *ref_sweep;
     int length;
+    /* indices past small are the slots of large frames */
+    int small;
     int max;
 } frame_table_t;
 
@@ -41,12 +121,67 @@ extern unsigned first_available_frame;
 
 void initialize_frame_table(cspace_t *cspace);
 
+/* the frame comes back filled with zeros */
 int frame_alloc(seL4_Word *vaddr);
 
-/* cannot use with frame_free */
+/* for callers which overwrite the whole frame anyway */
+int frame_alloc_nozero(seL4_Word *vaddr);
+
+/* a dirty frame only if one is there without swapping anything out, or -1 */
+int frame_alloc_noevict(seL4_Word *vaddr);
+
+/* a frame of the zeroed reserve, -1 rather than clearing or evicting one */
+int frame_alloc_prezeroed(seL4_Word *vaddr);
+
+/*
+ * nframes contiguous frames, frame i of the run is at *vaddr + i * PAGE_SIZE_4K.
+ * Every frame comes back filled with zeros. Cannot use with frame_free.
+ */
 int frame_n_alloc(seL4_Word *vaddr, int nframes);
 
 /* could only accept frame returned by frame_n_alloc unless n == 1 */
 void frame_n_free(int frames);
 
-void frame_free(int frame);
\ No newline at end of file
+/*
+ * 2M frame backed by one of the large untypeds, mapped into SOS at *vaddr.
+ * Returns the first of its FRAME_LARGE_PAGES indices, -1 if none are left.
+ * Index i of the frame sits at *vaddr + i * PAGE_SIZE_4K like any other frame.
+ */
+int frame_large_alloc(seL4_Word *vaddr);
+
+void frame_large_free(int frame);
+
+/* take another reference on an allocated frame */
+void frame_ref(int frame);
+
+/*
+ * drop a reference, the last one puts the frame into the free pool,
+ * where it stays retyped and mapped in SOS
+ */
+void frame_free(int frame);
+
+/* record / forget a process mapping the frame at vaddr */
+void frame_rmap_add(int frame, int pid, seL4_Word vaddr);
+void frame_rmap_remove(int frame, int pid, seL4_Word vaddr);
+
+/* number of processes mapping the frame */
+int frame_nmappers(int frame);
+
+/* drop every mapper and reference, the caller keeps the frame pinned for itself */
+void frame_recycle(int frame);
+
+/* give the frame straight back to untyped memory, bypassing the pool,
+ * no matter how many references are left */
+void frame_release(int frame);
+
+/* return one pooled frame to untyped memory, false if the pool is empty */
+bool frame_pool_reclaim(void);
+
+/* true while the zeroed reserve is below its target and there is dirty work */
+bool frame_zero_pending(void);
+
+/* idle coroutine, clears one dirty frame into the reserve per resume */
+void *frame_zero_worker(void *arg);
+
+/* fill in the frame counts of a vmstat snapshot */
+void frame_table_stat(sos_vmstat_t *stat);
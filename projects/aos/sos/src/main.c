@@ -28,6 +28,7 @@
 
 #include "addrspace.h"
 #include "bootstrap.h"
+#include "dedup.h"
 #include "drivers/uart.h"
 #include "elfload.h"
 #include "frametable.h"
@@ -199,7 +200,7 @@ static ut_t *alloc_retype(seL4_CPtr *cptr, seL4_Word type, size_t size_bits)
 void *_start_process(char *app_name)
 {
     int pid;
-    start_process(app_name, ipc_ep, &pid);
+    start_process(app_name, ipc_ep, PROC_RSS_LIMIT, &pid);
     return (void *)pid;
 }
 
@@ -315,6 +316,7 @@ NORETURN void *main_continued(UNUSED void *arg)
                 badge_irq_ntfn(ntfn, IRQ_BADGE_TIMER),
                 timer_vaddr,
                 F);
+    dedup_init();
 
     /* Initialise libserial */
     vfs_bootstrap();
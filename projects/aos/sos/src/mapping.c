@@ -167,28 +167,32 @@ seL4_Error map_frame(cspace_t *cspace, seL4_CPtr frame_cap, seL4_CPtr vspace,
                           NULL);
 }
 
-seL4_Error sos_map_frame(cspace_t *cspace, int frame, proc *cur_proc,
-                         seL4_Word vaddr, seL4_CapRights_t rights,
-                         seL4_ARM_VMAttributes attr)
+/*
+ * map a copy of origin_cap into the process at vaddr, building the page
+ * tables and their shadows on the way. the copy gets cap_rights and the
+ * mapping rights, it is returned in *mapped, the level 4 shadow entry is
+ * left for the caller to fill in
+ */
+static seL4_Error map_user_frame(cspace_t *cspace, seL4_CPtr origin_cap, proc *cur_proc,
+                                 seL4_Word vaddr, seL4_CapRights_t cap_rights,
+                                 seL4_CapRights_t rights, seL4_ARM_VMAttributes attr,
+                                 seL4_CPtr *mapped)
 {
     seL4_Word page_table = (seL4_Word)cur_proc->pt;
     seL4_CPtr vspace = cur_proc->vspace;
 
-    if (frame < 0) return seL4_NotEnoughMemory;
-
-    /* allign vaddr */
-    vaddr = vaddr & PAGE_FRAME;
-
     /* copy frame_cap into a new cap */
-    seL4_CPtr origin_cap = frame_table.frames[frame].frame_cap;
     // printf("FRAME_CAP is %ld\n", origin_cap);
     seL4_CPtr frame_cap = cspace_alloc_slot(cspace);
     if (frame_cap == seL4_CapNull) {
         ZF_LOGE("OUT OF CAP\n");
+        return seL4_NotEnoughMemory;
     }
-    seL4_Error err = cspace_copy(cspace, frame_cap, cspace, origin_cap, rights);
+    seL4_Error err = cspace_copy(cspace, frame_cap, cspace, origin_cap, cap_rights);
     if (err) {
         ZF_LOGE("FAILE TO COPY CAP, SOMETHING WRONG!");
+        cspace_free_slot(cspace, frame_cap);
+        return err;
     }
     err = seL4_ARM_Page_Map(frame_cap, vspace, vaddr, rights, attr);
 
@@ -197,6 +201,9 @@ seL4_Error sos_map_frame(cspace_t *cspace, int frame, proc *cur_proc,
     ut_t *ut_array[MAPPING_SLOTS] = { 0, 0, 0 };
     int frame_array[MAPPING_SLOTS] = { -1, -1, -1 };
     seL4_CPtr slot_array[MAPPING_SLOTS] = { 0, 0, 0 };
+    /* the shadow entries put in so far, to take out again on failure */
+    int level_array[MAPPING_SLOTS] = { 0, 0, 0 };
+    bool kept_array[MAPPING_SLOTS] = { false, false, false };
     /* keep track of all allocated resources in case that allocation failed in some intermediate steps */
     for (size_t i = 0; i < MAPPING_SLOTS && err == seL4_FailedLookup; i++) {
         /* save this so nothing else trashes the message register value */
@@ -241,8 +248,14 @@ seL4_Error sos_map_frame(cspace_t *cspace, int frame, proc *cur_proc,
             // level 4
             level = 4;
             err = retype_map_pt(cspace, vspace, vaddr, ut->cap, slot);
-            /* only need two page in level 4 shadow page table */
-            page_frame = frame_n_alloc(&page_table_addr, 2);
+            /* a demoted large page leaves its level 4 shadow table behind */
+            page_table_addr = get_shadow_page_table((page_table_t *)page_table, vaddr, 4);
+            if (page_table_addr) {
+                kept_array[i] = true;
+                entry.frame = -1;
+                break;
+            }
+            page_frame = frame_n_alloc(&page_table_addr, PAGE_TABLE_FRAME_SIZE);
             frame_array[i] = page_frame;
             if (page_frame == -1) {
                 goto cleanup;
@@ -279,33 +292,92 @@ seL4_Error sos_map_frame(cspace_t *cspace, int frame, proc *cur_proc,
         entry.slot = slot;
         entry.table_addr = page_table_addr;
         entry.ut = ut;
-        insert_page_table_entry((page_table_t *)page_table, &entry, level, vaddr);
+        if (!err) {
+            err = insert_page_table_entry((page_table_t *)page_table, &entry, level, vaddr);
+            if (!err) {
+                level_array[i] = level;
+            }
+        }
         if (!err) {
             /* Try the mapping again */
             err = seL4_ARM_Page_Map(frame_cap, vspace, vaddr, rights, attr);
         }
     }
     if (!err) {
-        entry.frame = frame;
-        entry.slot = frame_cap;
-        update_level_4_page_table_entry((page_table_t *)page_table, &entry, vaddr);
-        SET_PID(frame, cur_proc->status.pid);
+        *mapped = frame_cap;
         return err;
     }
 cleanup:
-    /* clean up all the resouces */
-    for (size_t i = 0; i < MAPPING_SLOTS; ++i) {
+    /* clean up all the resouces, the lowest level first so no shadow
+     * entry is left pointing at a table that is gone */
+    for (size_t i = MAPPING_SLOTS; i-- > 0;) {
+        if (level_array[i]) {
+            remove_page_table_entry((page_table_t *)page_table, level_array[i], vaddr,
+                                    kept_array[i]);
+        }
+        if (slot_array[i]) {
+            cspace_delete(cspace, slot_array[i]);
+            cspace_free_slot(cspace, slot_array[i]);
+        }
         if (ut_array[i]) {
             ut_free(ut_array[i], seL4_PageBits);
         }
         if (frame_array[i] != -1) {
             frame_n_free(frame_array[i]);
         }
-        if (slot_array[i]) {
-            cspace_delete(cspace, slot_array[i]);
-            cspace_free_slot(cspace, slot_array[i]);
+    }
+    cspace_delete(cspace, frame_cap);
+    cspace_free_slot(cspace, frame_cap);
+    return err ? err : seL4_NotEnoughMemory;
+}
+
+seL4_Error sos_map_frame(cspace_t *cspace, int frame, proc *cur_proc,
+                         seL4_Word vaddr, seL4_CapRights_t rights,
+                         seL4_ARM_VMAttributes attr)
+{
+    page_table_entry entry;
+    seL4_CPtr frame_cap;
+
+    if (frame < 0) return seL4_NotEnoughMemory;
+
+    /* allign vaddr */
+    vaddr = vaddr & PAGE_FRAME;
+
+    /* the cap outlives the clock's unmaps and may be mapped again with
+     * more rights than now, only the mapping is held to rights */
+    seL4_Error err = map_user_frame(cspace, frame_table.backing[frame].frame_cap, cur_proc,
+                                    vaddr, seL4_AllRights, rights, attr, &frame_cap);
+    if (!err) {
+        entry.frame = frame;
+        entry.slot = frame_cap;
+        update_level_4_page_table_entry(cur_proc->pt, &entry, vaddr);
+        frame_rmap_add(frame, cur_proc->status.pid, vaddr);
+    }
+    return err;
+}
+
+/* the one frame every page that reads as zeros is mapped to, never written */
+static int zero_frame = -1;
+
+seL4_Error sos_map_zero_frame(cspace_t *cspace, proc *cur_proc, seL4_Word vaddr,
+                              seL4_CapRights_t rights)
+{
+    seL4_CPtr frame_cap;
+
+    if (zero_frame == -1) {
+        /* it stays pinned, the clock never sees it */
+        zero_frame = frame_alloc(NULL);
+        if (zero_frame == -1) {
+            return seL4_NotEnoughMemory;
         }
     }
+    vaddr = vaddr & PAGE_FRAME;
+    seL4_Error err = map_user_frame(cspace, frame_table.backing[zero_frame].frame_cap, cur_proc,
+                                    vaddr, rights, rights, seL4_ARM_Default_VMAttributes,
+                                    &frame_cap);
+    if (!err) {
+        map_zero_page(cur_proc->pt, vaddr, frame_cap);
+    }
     return err;
 }
 
@@ -92,6 +92,15 @@ seL4_Error sos_map_frame(cspace_t *cspace, int frame, proc *cur_proc,
                          seL4_Word vaddr, seL4_CapRights_t rights,
                          seL4_ARM_VMAttributes attr);
 
+/*
+ * Map the shared zero frame read-only at vaddr, for a page that has never
+ * been written. rights must not allow writing.
+ *
+ * @return 0 on success
+ */
+seL4_Error sos_map_zero_frame(cspace_t *cspace, proc *cur_proc, seL4_Word vaddr,
+                              seL4_CapRights_t rights);
+
 /*
  * Map a device and return the virtual address it is mapped to.
  *
@@ -185,6 +185,17 @@ static void nfs_read_cb(int status, UNUSED struct nfs_context *nfs, void *data,
     memcpy(cb->data, data, status);
     cb->data = NULL;
 }
+/*
+ * a transfer in SOS's own memory goes out as one request at its own offset,
+ * so transfers like the swapping file's may overlap and take no lock
+ */
+static inline void nv_unlock(struct nfs_vnode *nv, bool locked)
+{
+    if (locked) {
+        nv->lock = 0;
+    }
+}
+
 /*
  * VOP_READ
  */
@@ -196,13 +207,16 @@ static int _nfs_read(struct vnode *v, struct uio *uio)
     int result;
     void *aborted = 0;
     seL4_Error err;
+    bool locked = uio->uio_segflg == UIO_USERSPACE;
     assert(uio->uio_rw == UIO_READ);
 
-    while (nv->lock == 1) {
+    while (locked && nv->lock == 1) {
         aborted = yield(NULL);
     }
     if (aborted) return -1;
-    nv->lock = 1;
+    if (locked) {
+        nv->lock = 1;
+    }
 
     /* read frame by frame */
     seL4_Word sos_vaddr, user_vaddr = uio->vaddr;
@@ -214,13 +228,13 @@ static int _nfs_read(struct vnode *v, struct uio *uio)
 
     while (uio->uio_resid > 0) {
         if (uio->uio_segflg == UIO_USERSPACE) {
-            sos_vaddr = get_sos_virtual_address(uio->proc->pt, user_vaddr);
+            sos_vaddr = get_sos_virtual_address(uio->proc, user_vaddr, true);
             if (sos_vaddr == 0) {
                 err = handle_page_fault(uio->proc, user_vaddr, 0);
                 if (err) {
                     return err;
                 }
-                sos_vaddr = get_sos_virtual_address(uio->proc->pt, user_vaddr);
+                sos_vaddr = get_sos_virtual_address(uio->proc, user_vaddr, true);
             }
             count = n;
         } else {
@@ -236,7 +250,7 @@ static int _nfs_read(struct vnode *v, struct uio *uio)
         result = nfs_pread_async(nf->context, nv->handle, uio->uio_offset,
                                  count, nfs_read_cb, &cb);
         if (result) {
-            nv->lock = 0;
+            nv_unlock(nv, locked);
             return result;
         }
         /* wait until callback done */
@@ -245,7 +259,7 @@ static int _nfs_read(struct vnode *v, struct uio *uio)
         }
         /* callback got sth wrong */
         if (aborted || cb.status < 0) {
-            nv->lock = 0;
+            nv_unlock(nv, locked);
             return cb.status;
         }
 
@@ -258,13 +272,13 @@ static int _nfs_read(struct vnode *v, struct uio *uio)
         n = uio->uio_resid > PAGE_SIZE_4K ? PAGE_SIZE_4K : uio->uio_resid;
 
         if (nbytes < count) {
-            nv->lock = 0;
+            nv_unlock(nv, locked);
             /* it's over */
             return 0;
         }
 
     }
-    nv->lock = 0;
+    nv_unlock(nv, locked);
     return 0;
 }
 
@@ -330,13 +344,16 @@ static int _nfs_write(struct vnode *v, struct uio *uio)
     int result;
     void *aborted = 0;
     seL4_Word err;
+    bool locked = uio->uio_segflg == UIO_USERSPACE;
     assert(uio->uio_rw == UIO_WRITE);
 
-    while (nv->lock == 1) {
+    while (locked && nv->lock == 1) {
         aborted = yield(NULL);
     }
     if (aborted) return -1;
-    nv->lock = 1;
+    if (locked) {
+        nv->lock = 1;
+    }
 
     /* read frame by frame */
 
@@ -349,14 +366,14 @@ static int _nfs_write(struct vnode *v, struct uio *uio)
 
     while (uio->uio_resid > 0) {
         if (uio->uio_segflg == UIO_USERSPACE) {
-            sos_vaddr = get_sos_virtual_address(uio->proc->pt, user_vaddr);
+            sos_vaddr = get_sos_virtual_address(uio->proc, user_vaddr, false);
 
             if (sos_vaddr == 0) {
                 err = handle_page_fault(uio->proc, user_vaddr, 0);
                 if (err) {
                     return err;
                 }
-                sos_vaddr = get_sos_virtual_address(uio->proc->pt, user_vaddr);
+                sos_vaddr = get_sos_virtual_address(uio->proc, user_vaddr, false);
             }
             count = n;
         } else {
@@ -373,7 +390,7 @@ static int _nfs_write(struct vnode *v, struct uio *uio)
                                   count, (void *)sos_vaddr, nfs_write_cb, &cb);
         if (result) {
             // printf("lock release\n");
-            nv->lock = 0;
+            nv_unlock(nv, locked);
             return result;
         }
         /* wait until callback done */
@@ -383,7 +400,7 @@ static int _nfs_write(struct vnode *v, struct uio *uio)
         /* callback got sth wrong */
         if (aborted || cb.status < 0) {
             // printf("lock release\n");
-            nv->lock = 0;
+            nv_unlock(nv, locked);
             return cb.status;
         }
 
@@ -395,12 +412,12 @@ static int _nfs_write(struct vnode *v, struct uio *uio)
         if (nbytes < count) {
             /* it's over */
             // printf("lock release\n");
-            nv->lock = 0;
+            nv_unlock(nv, locked);
             return 0;
         }
     }
     // printf("lock release\n");
-    nv->lock = 0;
+    nv_unlock(nv, locked);
     return 0;
 }
 
@@ -995,9 +1012,6 @@ void nfs_mount_cb(int status, struct nfs_context *nfs, void *data,
     struct vnode *vn;
     vn = nfs_bootstrap(nfs);
     change_bootfs(vn);
-
-    initialize_swapping_file();
-
 }
 
 struct vnode *nfs_bootstrap(struct nfs_context *context)
@@ -1,74 +1,270 @@
 #include "pagetable.h"
 #include "addrspace.h"
 #include "frametable.h"
+#include "xlate.h"
 #include "mapping.h"
 #include "proc.h"
 #include "backtrace.h"
 
 #include <string.h>
 
-#define PRESENT  (1lu << 50)
-#define PAGE_RW  (1lu << 51)
-#define UNMAPPED (1lu << 52)
-#define OFFSET 0xffffffffffff
+/* write not read bit of the fault status of a data abort */
+#define FSR_WNR BIT(6)
+
+/*
+ * a level 3 entry tagged LARGE_PAGE is backed by one 2M frame instead of a
+ * hardware page table, its pt_obj holds the large page mapping. UNMAPPED
+ * on such an entry means the clock has taken the mapping away. The level 4
+ * shadow table below it is kept and points at the 4K pieces of the frame.
+ */
+#define LARGE_PAGE (1lu << 53)
+#define LARGE_PAGE_SIZE BIT(seL4_LargePageBits)
+
+/*
+ * every shadow table is a single frame of 64 bit entries. the low bits of
+ * an entry hold a frame index and the bits above it a second field:
+ *
+ *   levels 1-3  the shadow table below, and the pt_obj keeping the cap and
+ *               ut of the hardware table below
+ *   level 4     the frame of the page and the cap mapping it into the
+ *               process, kept while the entry is UNMAPPED. a ZERO_PAGE
+ *               entry holds the cap of its zero frame mapping alone
+ *
+ * a swapped out page has no cap, its entry uses all of OFFSET for the slot.
+ * caps fit in the field as the SOS cspace has 2^20 slots
+ */
+#define ENTRY_FIELD_BITS 20
+#define ENTRY_FIELD(x) (((x) >> ENTRY_FRAME_BITS) & MASK(ENTRY_FIELD_BITS))
+#define ENTRY_FIELD_MASK (MASK(ENTRY_FIELD_BITS) << ENTRY_FRAME_BITS)
+
+/* pages a fault maps around it, by the region it hits, 0 turns it off */
+#ifndef FAULT_AROUND_IMAGE
+#ifdef CONFIG_SOS_FAULT_AROUND_IMAGE
+#define FAULT_AROUND_IMAGE CONFIG_SOS_FAULT_AROUND_IMAGE
+#else
+#define FAULT_AROUND_IMAGE 16
+#endif
+#endif
+#ifndef FAULT_AROUND_HEAP
+#ifdef CONFIG_SOS_FAULT_AROUND_HEAP
+#define FAULT_AROUND_HEAP CONFIG_SOS_FAULT_AROUND_HEAP
+#else
+#define FAULT_AROUND_HEAP 8
+#endif
+#endif
+#ifndef FAULT_AROUND_STACK
+#ifdef CONFIG_SOS_FAULT_AROUND_STACK
+#define FAULT_AROUND_STACK CONFIG_SOS_FAULT_AROUND_STACK
+#else
+#define FAULT_AROUND_STACK 4
+#endif
+#endif
+/* untouched pages around a write fault get a frame of the zeroed reserve too */
+#ifndef FAULT_AROUND_ZERO
+#ifdef CONFIG_SOS_FAULT_AROUND_ZERO
+#define FAULT_AROUND_ZERO CONFIG_SOS_FAULT_AROUND_ZERO
+#else
+#define FAULT_AROUND_ZERO 0
+#endif
+#endif
 
 extern cspace_t *global_cspace;
 
-typedef struct page_table {
-    seL4_Word page_obj_addr[PAGE_TABLE_SIZE];
-} page_table_t;
+/* the hardware object below an upper level entry */
+typedef struct pt_obj {
+    seL4_CPtr cap;
+    ut_t *ut;
+} pt_obj;
 
-typedef struct page_table_cap {
-    seL4_Word cap[PAGE_TABLE_SIZE];
-} page_table_cap;
+#define PT_OBJS_PER_FRAME (PAGE_SIZE_4K / sizeof(pt_obj))
+#define PT_OBJ_FRAMES (BIT(ENTRY_FIELD_BITS) / PT_OBJS_PER_FRAME)
 
-typedef struct page_table_ut {
-    ut_t *ut[PAGE_TABLE_SIZE];
-} page_table_ut;
+/* handed out by index, 0 is never used. free ones are linked through cap */
+static pt_obj *pt_obj_frames[PT_OBJ_FRAMES];
+static unsigned pt_objs = 0;
+static unsigned pt_obj_free = 0;
 
+/*
+ * PRESENT entries of each level 4 table, by the frame of the table. shadow
+ * tables are always small frames. a fault only looks at a 2M range for
+ * promotion once all of it is resident
+ */
+static uint16_t leaf_resident[MAX_MEM / PAGE_SIZE_4K];
+#define LEAF_RESIDENT(pt) leaf_resident[((seL4_Word)(pt) - FRAME_BASE) / PAGE_SIZE_4K]
+
+compile_time_assert(xlate_cache_fits, sizeof(xlate_cache) <= PAGE_SIZE_4K);
+compile_time_assert(xlate_entries_pow2, (XLATE_ENTRIES & (XLATE_ENTRIES - 1)) == 0);
 
-/* find out the frame contains the ut / cap */
-static page_table_cap *get_page_table_cap(seL4_Word page_table)
+
+static pt_obj *get_pt_obj(unsigned obj)
 {
-    int frame = (page_table - FRAME_BASE) / PAGE_SIZE_4K;
-    int cap_frame = frame_table.frames[frame].next;
-    return (page_table_cap *)(cap_frame * PAGE_SIZE_4K + FRAME_BASE);
+    return &pt_obj_frames[obj / PT_OBJS_PER_FRAME][obj % PT_OBJS_PER_FRAME];
 }
 
-static page_table_ut *get_page_table_ut(seL4_Word page_table)
+/* the pt_obj of an upper level entry */
+static pt_obj *entry_obj(seL4_Word entry)
 {
-    int frame = (page_table - FRAME_BASE) / PAGE_SIZE_4K;
-    int cap_frame = frame_table.frames[frame].next;
-    int ut_frame = frame_table.frames[cap_frame].next;
-    return (page_table_ut *)(ut_frame * PAGE_SIZE_4K + FRAME_BASE);
+    return get_pt_obj(ENTRY_FIELD(entry));
 }
 
-static int get_offset(seL4_Word vaddr, int n)
+/* a free pt_obj, 0 if there is no memory for one */
+static unsigned pt_obj_alloc(void)
 {
-    seL4_Word mask = 0xff8000000000 >> (9 * (n - 1));
-    seL4_Word offset = (mask & vaddr) >> (48 - 9 * n);
-    return (int)offset;
+    unsigned obj = pt_obj_free;
+    if (obj) {
+        pt_obj_free = get_pt_obj(obj)->cap;
+        return obj;
+    }
+    if (pt_objs == BIT(ENTRY_FIELD_BITS)) {
+        return 0;
+    }
+    if (pt_obj_frames[pt_objs / PT_OBJS_PER_FRAME] == NULL) {
+        seL4_Word vaddr;
+        if (frame_n_alloc(&vaddr, 1) == -1) {
+            return 0;
+        }
+        pt_obj_frames[pt_objs / PT_OBJS_PER_FRAME] = (pt_obj *)vaddr;
+        if (pt_objs == 0) {
+            pt_objs = 1;
+        }
+    }
+    return pt_objs++;
 }
 
-static seL4_Word get_n_level_table(seL4_Word page_table, seL4_Word vaddr, int n)
+/* the pool keeps its frames, a new table soon takes the pt_obj again */
+static void pt_obj_release(unsigned obj)
 {
-    /* page_table is the 1st level, so we start from 2nd level */
-    page_table_t *pt = (page_table_t *)page_table;
-    for (int i = 1; i < n; i++) {
-        int offset = get_offset(vaddr, i);
-        pt = (page_table_t *)pt->page_obj_addr[offset];
-        if (pt == NULL) {
-            return 0;
+    pt_obj *o = get_pt_obj(obj);
+    o->cap = pt_obj_free;
+    o->ut = NULL;
+    pt_obj_free = obj;
+}
+
+/* the cap mapping the page of a level 4 entry, if it has one */
+static seL4_CPtr entry_cap(seL4_Word entry)
+{
+    return entry & (PRESENT | ZERO_PAGE) ? ENTRY_FIELD(entry) : seL4_CapNull;
+}
+
+static seL4_Word entry_with_cap(seL4_Word entry, seL4_CPtr cap)
+{
+    assert(cap < BIT(ENTRY_FIELD_BITS));
+    return (entry & ~ENTRY_FIELD_MASK) | ((seL4_Word)cap << ENTRY_FRAME_BITS);
+}
+
+/* a level 4 entry changes whether it is PRESENT through here */
+static void set_leaf_entry(page_table_t *pt, int offset, seL4_Word entry)
+{
+    bool was = pt->page_obj_addr[offset] & PRESENT;
+    bool is = entry & PRESENT;
+    LEAF_RESIDENT(pt) += (int)is - (int)was;
+    pt->page_obj_addr[offset] = entry;
+}
+
+/*
+ * the level 4 table of vaddr and in *next the first address past it. if a
+ * table on the way is missing, NULL and the first address past the range
+ * that table would have covered
+ */
+static page_table_t *walk_leaf(page_table_t *table, seL4_Word vaddr, seL4_Word *next)
+{
+    page_table_t *pt = table;
+    for (int level = 1; level < 4; level++) {
+        page_table_t *below = NODE_TABLE(pt->page_obj_addr[get_offset(vaddr, level)]);
+        if (below == NULL) {
+            seL4_Word span = BIT(seL4_PageBits + 9 * (4 - level));
+            *next = (vaddr & ~(span - 1)) + span;
+            return NULL;
         }
+        pt = below;
     }
+    *next = (vaddr & ~(LARGE_PAGE_SIZE - 1)) + LARGE_PAGE_SIZE;
+    return pt;
+}
 
-    return (seL4_Word)pt;
+void page_range_walk(proc *process, seL4_Word start, seL4_Word end,
+                     page_run_fn fn, void *arg)
+{
+    seL4_Word vaddr = start & PAGE_FRAME, next;
+    while (vaddr < end) {
+        page_table_t *pt4 = walk_leaf(process->pt, vaddr, &next);
+        seL4_Word stop = MIN(next, end);
+        while (pt4 && vaddr < stop) {
+            if (pt4->page_obj_addr[get_offset(vaddr, 4)] == 0) {
+                vaddr += PAGE_SIZE_4K;
+                continue;
+            }
+            seL4_Word run = vaddr;
+            while (vaddr < stop && pt4->page_obj_addr[get_offset(vaddr, 4)]) {
+                vaddr += PAGE_SIZE_4K;
+            }
+            fn(process, run, (vaddr - run) / PAGE_SIZE_4K, arg);
+        }
+        vaddr = next;
+    }
+}
+
+static bool table_empty(page_table_t *pt)
+{
+    for (int i = 0; i < PAGE_TABLE_SIZE; i++) {
+        if (pt->page_obj_addr[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* the hardware table below an upper level entry goes, and its pt_obj */
+static void destroy_pt_obj(seL4_Word entry)
+{
+    pt_obj *o = entry_obj(entry);
+    /* a promoted large page leaves no hardware page table */
+    if (o->ut) {
+        cspace_delete(global_cspace, o->cap);
+        cspace_free_slot(global_cspace, o->cap);
+        ut_free(o->ut, seL4_PageBits);
+    }
+    pt_obj_release(ENTRY_FIELD(entry));
+}
+
+/* the empty leaf of vaddr goes, and every table above it left empty */
+static void free_empty_tables(page_table_t *table, seL4_Word vaddr)
+{
+    page_table_t *path[4] = { table };
+    for (int level = 1; level < 4; level++) {
+        path[level] = NODE_TABLE(path[level - 1]->page_obj_addr[get_offset(vaddr, level)]);
+    }
+    xlate_forget(table, vaddr);
+    for (int level = 3; level >= 1 && table_empty(path[level]); level--) {
+        seL4_Word *entry = &path[level - 1]->page_obj_addr[get_offset(vaddr, level)];
+        frame_n_free(ENTRY_FRAME(*entry));
+        destroy_pt_obj(*entry);
+        *entry = 0;
+    }
+}
+
+void page_range_trim(page_table_t *table, seL4_Word start, seL4_Word end)
+{
+    seL4_Word vaddr = start & PAGE_FRAME, next;
+    while (vaddr < end) {
+        page_table_t *pt4 = walk_leaf(table, vaddr, &next);
+        if (pt4 && table_empty(pt4)) {
+            free_empty_tables(table, vaddr);
+        }
+        vaddr = next;
+    }
+}
+
+seL4_Word get_shadow_page_table(page_table_t *table, seL4_Word vaddr, int level)
+{
+    return get_n_level_table((seL4_Word)table, vaddr, level);
 }
 
 page_table_t *initialize_page_table(void)
 {
     seL4_Word page_table_addr;
-    int page_frame = frame_n_alloc(&page_table_addr, 3);
+    assert(frame_table.length <= (int)BIT(ENTRY_FRAME_BITS));
+    int page_frame = frame_n_alloc(&page_table_addr, PAGE_TABLE_FRAME_SIZE + 1);
     return page_frame != -1 ? (page_table_t *)page_table_addr : NULL;
 }
 
@@ -77,126 +273,473 @@ seL4_Error insert_page_table_entry(page_table_t *table, page_table_entry *entry,
 {
     int offset;
     page_table_t *pt;
-    page_table_cap *pt_cap;
-    page_table_ut *pt_ut;
 
     /* save nth level hardware page table caps in nth-1 level shadow page table */
     pt = (page_table_t *)get_n_level_table((seL4_Word)table, vaddr, level - 1);
-    pt_cap = (page_table_cap *)get_page_table_cap((seL4_Word)pt);
-    pt_ut = (page_table_ut *)get_page_table_ut((seL4_Word)pt);
     offset = get_offset(vaddr, level - 1);
-    pt->page_obj_addr[offset] = entry->table_addr;
-    pt_cap->cap[offset] = entry->slot;
-    pt_ut->ut[offset] = entry->ut;
+    /* a demoted large page left its entry and pt_obj behind */
+    unsigned obj = ENTRY_FIELD(pt->page_obj_addr[offset]);
+    if (obj == 0) {
+        obj = pt_obj_alloc();
+        if (obj == 0) {
+            return seL4_NotEnoughMemory;
+        }
+    }
+    get_pt_obj(obj)->cap = entry->slot;
+    get_pt_obj(obj)->ut = entry->ut;
+    pt->page_obj_addr[offset] = (entry->table_addr - FRAME_BASE) / PAGE_SIZE_4K
+                                | ((seL4_Word)obj << ENTRY_FRAME_BITS);
 
     return seL4_NoError;
 }
 
+void remove_page_table_entry(page_table_t *table, int level, seL4_Word vaddr, bool keep)
+{
+    page_table_t *pt = (page_table_t *)get_n_level_table((seL4_Word)table, vaddr, level - 1);
+    seL4_Word *entry = &pt->page_obj_addr[get_offset(vaddr, level - 1)];
+    pt_obj *o = entry_obj(*entry);
+    o->cap = seL4_CapNull;
+    o->ut = NULL;
+    if (keep) {
+        return;
+    }
+    if (level == 4) {
+        xlate_forget(table, vaddr);
+    }
+    pt_obj_release(ENTRY_FIELD(*entry));
+    *entry = 0;
+}
 
-seL4_Error handle_page_fault(proc *cur_proc, seL4_Word vaddr,
-                             seL4_Word fault_info)
+
+static seL4_Error resolve_page_fault(proc *cur_proc, seL4_Word vaddr,
+                                     seL4_Word fault_info);
+
+/* a process at its limit makes room with one of its own pages */
+static void enforce_rss_limit(proc *cur_proc)
+{
+    if (cur_proc->rss_limit && cur_proc->rss >= cur_proc->rss_limit) {
+        swap_out_process(cur_proc);
+    }
+}
+
+/*
+ * a page that reads as zeros, never touched or evicted all zeros. a read by
+ * the process maps the shared zero frame, only the first write gets the
+ * page a frame of its own. SOS touching the page for the process passes no
+ * fault_info and always gets it a frame, it writes through its own mapping
+ */
+static seL4_Error zero_fill(proc *cur_proc, seL4_Word vaddr, seL4_Word entry,
+                            seL4_Word fault_info, bool execute, bool read, bool write)
+{
+    seL4_Error err;
+
+    cur_proc->status.zeroflt++;
+    if (fault_info && !(fault_info & FSR_WNR)) {
+        if (entry && !(entry & UNMAPPED)) {
+            // the zero frame is mapped already, it's a bad access
+            return seL4_RangeError;
+        }
+        err = sos_map_zero_frame(global_cspace, cur_proc, vaddr,
+                                 seL4_CapRights_new(execute, read, false));
+        if (!err) {
+            vmstat_events.zero_maps++;
+            if (!entry) {
+                ++cur_proc->status.size;
+            }
+        }
+        return err;
+    }
+    if (fault_info && !write) {
+        return seL4_RangeError;
+    }
+    enforce_rss_limit(cur_proc);
+    vmstat_events.zero_fills++;
+    int frame = frame_alloc(NULL);
+    if (frame <= 0) {
+        return -1;
+    }
+    // the zero frame makes way, the allocation may have let anything happen
+    seL4_Word now = _get_frame_from_vaddr(cur_proc->pt, vaddr);
+    if ((now & ZERO_PAGE) && !(now & UNMAPPED)) {
+        drop_page_cap(cur_proc->pt, vaddr);
+        update_page_status(cur_proc->pt, vaddr, true, true, 0);
+    }
+    err = sos_map_frame(global_cspace, frame, cur_proc,
+                        vaddr, seL4_CapRights_new(execute, read, write), seL4_ARM_Default_VMAttributes);
+    if (err) {
+        frame_free(frame);
+        return err;
+    }
+    if (!entry) {
+        ++cur_proc->status.size;
+    }
+    return err;
+}
+
+/*
+ * first write to a page whose frame other pages were merged into, it gets
+ * a copy of its own. entry is what the page table held at the fault
+ */
+static seL4_Error break_sharing(proc *cur_proc, seL4_Word vaddr, seL4_Word entry,
+                                seL4_Word fault_info, seL4_CapRights_t rights)
+{
+    int frame = entry & OFFSET;
+    int copy = frame_alloc_nozero(NULL);
+    if (copy <= 0) {
+        return seL4_NotEnoughMemory;
+    }
+    if (_get_frame_from_vaddr(cur_proc->pt, vaddr) != entry) {
+        /* the page moved while we were waiting for a frame, SOS itself
+         * passes no fault_info and looks again on its own */
+        frame_free(copy);
+        return fault_info ? resolve_page_fault(cur_proc, vaddr, fault_info) : seL4_NoError;
+    }
+    memcpy((void *)(FRAME_BASE + PAGE_SIZE_4K * copy),
+           (void *)(FRAME_BASE + PAGE_SIZE_4K * frame), PAGE_SIZE_4K);
+    drop_page_cap(cur_proc->pt, vaddr);
+    seL4_Error err = sos_map_frame(global_cspace, copy, cur_proc, vaddr, rights,
+                                   seL4_ARM_Default_VMAttributes);
+    if (err) {
+        /* still on the shared frame, mapped again by the next fault */
+        update_page_status(cur_proc->pt, vaddr, true, true, 0);
+        frame_free(copy);
+        return err;
+    }
+    frame_rmap_remove(frame, cur_proc->status.pid, vaddr);
+    frame_free(frame);
+    vmstat_events.dedup_breaks++;
+    return seL4_NoError;
+}
+
+static unsigned fault_around_pages(proc *cur_proc, as_region *region)
+{
+    if (region == cur_proc->as->ipcbuffer) {
+        return 0;
+    }
+    if (region == cur_proc->as->stack) {
+        return FAULT_AROUND_STACK;
+    }
+    /* mmap regions are anonymous like the heap */
+    if (region == cur_proc->as->heap || (region->flags & RG_LARGE)) {
+        return FAULT_AROUND_HEAP;
+    }
+    return FAULT_AROUND_IMAGE;
+}
+
+/*
+ * a page next to a fault that the clock only unmapped gets its kept cap
+ * mapped again, with the rights the fault itself would have given it.
+ * pages on their way in or out and read-around ones are left to fault
+ */
+static bool around_remap(proc *cur_proc, seL4_Word vaddr, seL4_Word entry,
+                         bool execute, bool read, bool write)
+{
+    int frame = ENTRY_FRAME(entry);
+    if (!(entry & PRESENT) || !(entry & UNMAPPED) || entry_cap(entry) == seL4_CapNull
+        || FRAME_GET_BIT(frame, PIN) || FRAME_GET_BIT(frame, PREFETCH)
+        || swap_in_transit(cur_proc, vaddr)) {
+        return false;
+    }
+    seL4_CapRights_t rights = seL4_CapRights_new(execute, read,
+                              write && !frame_table.slot[frame]
+                              && frame_nmappers(frame) == 1);
+    return remap_page(cur_proc, vaddr, rights) == seL4_NoError;
+}
+
+/* an untouched page next to a write fault, only if a zeroed frame is at hand */
+static bool around_fill(proc *cur_proc, seL4_Word vaddr, bool execute, bool read)
+{
+    if (cur_proc->rss_limit && cur_proc->rss >= cur_proc->rss_limit) {
+        return false;
+    }
+    int frame = frame_alloc_prezeroed(NULL);
+    if (frame == -1) {
+        return false;
+    }
+    if (sos_map_frame(global_cspace, frame, cur_proc, vaddr,
+                      seL4_CapRights_new(execute, read, true),
+                      seL4_ARM_Default_VMAttributes)) {
+        frame_free(frame);
+        return false;
+    }
+    ++cur_proc->status.size;
+    return true;
+}
+
+/*
+ * map the neighbours of a fault that need no I/O, in an aligned window of
+ * the region's fault-around size that stays inside the region and the 2M
+ * range of the fault, so every page is in the leaf table the fault used
+ */
+static void fault_around(proc *cur_proc, as_region *region, seL4_Word vaddr,
+                         seL4_Word fault_info)
+{
+    seL4_Word npages = MIN(fault_around_pages(cur_proc, region), (unsigned)PAGE_TABLE_SIZE);
+    if (npages <= 1) {
+        return;
+    }
+    bool execute = region->flags & RG_X;
+    bool read = region->flags & RG_R;
+    bool write = region->flags & RG_W;
+    bool fill = FAULT_AROUND_ZERO && write && (fault_info & FSR_WNR);
+    vaddr &= PAGE_FRAME;
+    seL4_Word span = npages * PAGE_SIZE_4K;
+    seL4_Word start = MAX(vaddr - vaddr % span,
+                          MAX(region->vaddr & PAGE_FRAME,
+                              vaddr & ~(LARGE_PAGE_SIZE - 1)));
+    seL4_Word end = MIN(vaddr - vaddr % span + span,
+                        MIN(region->vaddr + region->size,
+                            (vaddr & ~(LARGE_PAGE_SIZE - 1)) + LARGE_PAGE_SIZE));
+
+    for (seL4_Word v = start; v < end; v += PAGE_SIZE_4K) {
+        if (v == vaddr) {
+            continue;
+        }
+        page_table_t *pt = get_leaf_table(cur_proc->pt, v);
+        if (pt == NULL) {
+            return;
+        }
+        seL4_Word entry = pt->page_obj_addr[get_offset(v, 4)];
+        if (around_remap(cur_proc, v, entry, execute, read, write)) {
+            vmstat_events.around_maps++;
+        } else if (fill && entry == 0) {
+            if (!around_fill(cur_proc, v, execute, read)) {
+                // the reserve ran dry, the rest may still be resident
+                fill = false;
+                continue;
+            }
+            vmstat_events.around_fills++;
+        }
+    }
+}
+
+/* a fault looked at again after a wait is still the same fault */
+static seL4_Error resolve_page_fault(proc *cur_proc, seL4_Word vaddr,
+                                     seL4_Word fault_info)
 {
     // need to figure out which process triggered the page fault
     // right now, there is only one process (tty_test)
-    (void)fault_info;
     seL4_Word frame;
-    as_region *region = cur_proc->as->regions;
+    as_region *region = vaddr_get_region(cur_proc->as, vaddr);
     bool execute, read, write;
     seL4_Error err;
 
-    region = cur_proc->as->regions;
     // printf("handle page fault for vaddr %p\n", vaddr);
-    while (region) {
-        if (vaddr >= region->vaddr && vaddr < region->vaddr + region->size) {
-            execute = region->flags & RG_X;
-            read = region->flags & RG_R;
-            write = region->flags & RG_W;
-            // write to a read-only page
-            frame = _get_frame_from_vaddr(cur_proc->pt, vaddr);
-            if (frame == 0) {
-                /* it's a vm fault without page */
-                // allocate a frame
-                int frame = frame_alloc(NULL);
-                if (frame <= 0) {
-                    // printf("not enough mem\n");
-                    return -1;
-                }
-                // map it
-                err = sos_map_frame(global_cspace, frame, cur_proc,
-                                    vaddr, seL4_CapRights_new(execute, read, write), seL4_ARM_Default_VMAttributes);
-                // update process_status->size
-                ++cur_proc->status.size;
-            } else if ((frame & PRESENT) && (frame & UNMAPPED))  {
-                /* the page is still there and is not swapped*/
-                frame = frame & OFFSET;
-                err = sos_map_frame(global_cspace, frame, cur_proc,
-                                    vaddr, seL4_CapRights_new(execute, read, write), seL4_ARM_Default_VMAttributes);
-
-            } else if ((frame & PRESENT) && (frame & UNMAPPED) == false) {
-                // write on read-only page segmentation fault
-                // printf("write on read only\n");
-                return seL4_RangeError;
-            } else if (!(frame & PRESENT)) {
-                // page is in swapping file
-                //seL4_Word offset = frame & OFFSET;
-                int frame_handle = frame_alloc(NULL);
-                if (frame_handle <= 0) {
-                    return -1;
-                }
-                err = load_page(cur_proc, vaddr, frame_handle * PAGE_SIZE_4K + FRAME_BASE);
-                if (err) {
-                    // printf("load page fail\n");
-                    frame_free(frame_handle);
-                    return err;
-                }
-                err = sos_map_frame(global_cspace, frame_handle, cur_proc,
-                                    vaddr, seL4_CapRights_new(execute, read, write), seL4_ARM_Default_VMAttributes);
-            } else {
-                return seL4_RangeError;
-            }
+    if (region == NULL) {
+        /* failed */
+        return seL4_RangeError;
+    }
+    execute = region->flags & RG_X;
+    read = region->flags & RG_R;
+    write = region->flags & RG_W;
+    if (swap_in_transit(cur_proc, vaddr)) {
+        /* another coroutine is moving the page, look again once it's done */
+        err = swap_wait(cur_proc, vaddr);
+        return err ? err : resolve_page_fault(cur_proc, vaddr, fault_info);
+    }
+    if (is_large_page(cur_proc->pt, vaddr)) {
+        /* the clock took the 2M mapping away, otherwise it's a bad access */
+        return remap_large_page(cur_proc, vaddr,
+                                seL4_CapRights_new(execute, read, write));
+    }
+    // write to a read-only page
+    frame = _get_frame_from_vaddr(cur_proc->pt, vaddr);
+    if (frame == 0 || (!(frame & PRESENT) && (frame & ZERO_PAGE))) {
+        /* it's a vm fault without page, or with one of zeros */
+        err = zero_fill(cur_proc, vaddr, frame, fault_info, execute, read, write);
+    } else if ((frame & PRESENT) && (frame & UNMAPPED))  {
+        /* the page is still there and is not swapped*/
+        frame = frame & OFFSET;
+        cur_proc->status.minflt++;
+        if (FRAME_GET_BIT(frame, PREFETCH)) {
+            FRAME_CLEAR_BIT(frame, PREFETCH);
+            prefetch_hit(cur_proc);
+        }
+        /* a page whose copy in swap is still good stays read-only,
+         * and so does one shared with other pages of the same data */
+        seL4_CapRights_t rights = seL4_CapRights_new(execute, read,
+                                  write && !frame_table.slot[frame]
+                                  && frame_nmappers(frame) == 1);
+        /* the clock only took the mapping, its cap maps it again */
+        err = remap_page(cur_proc, vaddr, rights);
+        if (err) {
+            err = sos_map_frame(global_cspace, frame, cur_proc, vaddr, rights,
+                                seL4_ARM_Default_VMAttributes);
+        }
+
+    } else if ((frame & PRESENT) && (frame & UNMAPPED) == false) {
+        if (!write || !(fault_info & FSR_WNR)) {
+            // write on read-only page segmentation fault
+            // printf("write on read only\n");
+            return seL4_RangeError;
+        }
+        if (frame_nmappers(frame & OFFSET) > 1) {
+            return break_sharing(cur_proc, vaddr, frame, fault_info,
+                                 seL4_CapRights_new(execute, read, write));
+        }
+        /* first write to a clean page, its copy in swap is stale now */
+        frame = frame & OFFSET;
+        swap_cache_drop(frame);
+        unmap_page(cur_proc->pt, vaddr);
+        err = remap_page(cur_proc, vaddr, seL4_CapRights_new(execute, read, write));
+        if (err) {
+            err = sos_map_frame(global_cspace, frame, cur_proc,
+                                vaddr, seL4_CapRights_new(execute, read, write), seL4_ARM_Default_VMAttributes);
+        }
+    } else if (!(frame & PRESENT)) {
+        // page is in swapping file
+        //seL4_Word offset = frame & OFFSET;
+        enforce_rss_limit(cur_proc);
+        /* load_page overwrites the whole frame, no need to clear it */
+        int frame_handle = frame_alloc_nozero(NULL);
+        if (frame_handle <= 0) {
+            return -1;
+        }
+        if (_get_frame_from_vaddr(cur_proc->pt, vaddr) != frame
+            || swap_in_transit(cur_proc, vaddr)) {
+            /* the page moved while we were waiting for a frame */
+            frame_free(frame_handle);
+            return resolve_page_fault(cur_proc, vaddr, fault_info);
+        }
+        err = load_page(cur_proc, vaddr, frame_handle * PAGE_SIZE_4K + FRAME_BASE);
+        if (err) {
+            // printf("load page fail\n");
+            frame_free(frame_handle);
             return err;
         }
-        region = region->next;
+        cur_proc->status.majflt++;
+        /* mapped read-only while the slot still holds the same data,
+         * so evicting it again needs no write as long as it's clean */
+        err = sos_map_frame(global_cspace, frame_handle, cur_proc,
+                            vaddr, seL4_CapRights_new(execute, read,
+                                    write && !frame_table.slot[frame_handle]),
+                            seL4_ARM_Default_VMAttributes);
+    } else {
+        return seL4_RangeError;
+    }
+    if (!err && fault_info) {
+        /* the neighbours a sequential access would fault on next */
+        fault_around(cur_proc, region, vaddr, fault_info);
     }
-    /* failed */
-    // printf("no region\n");
-    return seL4_RangeError;
+    if (!err && (region->flags & RG_LARGE)) {
+        /* the fault may have filled up a 2M range, the old mapping is
+         * fine if it can't be promoted */
+        promote_large_page(cur_proc, region, vaddr);
+    }
+    return err;
+}
+
+seL4_Error handle_page_fault(proc *cur_proc, seL4_Word vaddr,
+                             seL4_Word fault_info)
+{
+    /* counted here once, however often it is looked at again */
+    vmstat_events.faults++;
+    proc_fault(cur_proc);
+    return resolve_page_fault(cur_proc, vaddr, fault_info);
 }
 
 void update_level_4_page_table_entry(page_table_t *table,
                                      page_table_entry *entry, seL4_Word vaddr)
 {
     /* save backend frame in level 4 shadow page table */
-    page_table_t *pt = (page_table_t *)get_n_level_table((seL4_Word)table, vaddr,
-                       4);
-    page_table_cap *pt_cap = (page_table_cap *)get_page_table_cap((seL4_Word)pt);
+    page_table_t *pt = get_leaf_table(table, vaddr);
     int offset = get_offset(vaddr, 4);
-    pt->page_obj_addr[offset] = entry->frame | PRESENT;
-    pt_cap->cap[offset] = entry->slot;
+    set_leaf_entry(pt, offset, entry_with_cap(entry->frame | PRESENT, entry->slot));
     if (vaddr != USERIPCBUFFER) {
         FRAME_CLEAR_BIT(entry->frame, PIN);
     }
     FRAME_SET_BIT(entry->frame, CLOCK);
-    frame_table.frames[entry->frame].vaddr = vaddr;
-    /* TODO: SETPID */
     // printf("frame %d, vaddr %d\n", entry->frame, vaddr);
 }
 
+void map_zero_page(page_table_t *table, seL4_Word vaddr, seL4_CPtr cap)
+{
+    page_table_t *pt = get_leaf_table(table, vaddr);
+    set_leaf_entry(pt, get_offset(vaddr, 4), entry_with_cap(ZERO_PAGE, cap));
+}
+
+/* the cap of a level 4 entry goes, out of the process first if still mapped */
+static void release_page_cap(page_table_t *pt, int offset)
+{
+    seL4_CPtr cap = entry_cap(pt->page_obj_addr[offset]);
+    if (cap == seL4_CapNull) {
+        return;
+    }
+    if (!(pt->page_obj_addr[offset] & UNMAPPED)) {
+        seL4_ARM_Page_Unmap(cap);
+    }
+    cspace_delete(global_cspace, cap);
+    cspace_free_slot(global_cspace, cap);
+    pt->page_obj_addr[offset] = entry_with_cap(pt->page_obj_addr[offset], seL4_CapNull);
+}
+
+void stage_page(page_table_t *table, seL4_Word vaddr, int frame)
+{
+    page_table_t *pt = get_leaf_table(table, vaddr);
+    if (pt == NULL) {
+        /* the range went away while the page was on its way */
+        return;
+    }
+    int offset = get_offset(vaddr, 4);
+    release_page_cap(pt, offset);
+    set_leaf_entry(pt, offset, frame | PRESENT | UNMAPPED);
+}
+
+void drop_page_cap(page_table_t *table, seL4_Word vaddr)
+{
+    page_table_t *pt = get_leaf_table(table, vaddr);
+    if (pt) {
+        release_page_cap(pt, get_offset(vaddr, 4));
+    }
+}
+
+void unmap_page(page_table_t *table, seL4_Word vaddr)
+{
+    page_table_t *pt = get_leaf_table(table, vaddr);
+    int offset = get_offset(vaddr, 4);
+    if (pt->page_obj_addr[offset] & UNMAPPED) {
+        return;
+    }
+    seL4_CPtr cap = entry_cap(pt->page_obj_addr[offset]);
+    if (cap != seL4_CapNull) {
+        seL4_ARM_Page_Unmap(cap);
+    }
+    pt->page_obj_addr[offset] |= UNMAPPED;
+}
+
+seL4_Error remap_page(proc *cur_proc, seL4_Word vaddr, seL4_CapRights_t rights)
+{
+    vaddr = vaddr & PAGE_FRAME;
+    page_table_t *pt = get_leaf_table(cur_proc->pt, vaddr);
+    int offset = get_offset(vaddr, 4);
+    seL4_Word entry = pt->page_obj_addr[offset];
+    if (!(entry & PRESENT) || !(entry & UNMAPPED) || entry_cap(entry) == seL4_CapNull) {
+        return seL4_FailedLookup;
+    }
+    seL4_Error err = seL4_ARM_Page_Map(entry_cap(entry), cur_proc->vspace, vaddr,
+                                       rights, seL4_ARM_Default_VMAttributes);
+    if (err) {
+        /* the caller makes a new one */
+        release_page_cap(pt, offset);
+        return err;
+    }
+    pt->page_obj_addr[offset] = entry & ~UNMAPPED;
+    int frame = ENTRY_FRAME(entry);
+    if (vaddr != USERIPCBUFFER) {
+        FRAME_CLEAR_BIT(frame, PIN);
+    }
+    FRAME_SET_BIT(frame, CLOCK);
+    return seL4_NoError;
+}
+
 seL4_CPtr get_cap_from_vaddr(page_table_t *table, seL4_Word vaddr)
 {
-    seL4_CPtr slot;
-    seL4_Word offset;
-    page_table_t *pt;
-    page_table_cap *pt_cap;
-    pt = (page_table_t *)get_n_level_table((seL4_Word)table, vaddr, 4);
+    page_table_t *pt = get_leaf_table(table, vaddr);
     /* we haven't got that vaddr yet */
     if (pt == NULL) {
         return 0;
     }
-    pt_cap = (page_table_cap *)get_page_table_cap((seL4_Word)pt);
-    offset = get_offset(vaddr, 4);
-    slot = pt_cap->cap[offset];
-    return slot;
+    return entry_cap(pt->page_obj_addr[get_offset(vaddr, 4)]);
 }
 
 /*
@@ -212,45 +755,68 @@ seL4_Word _get_frame_from_vaddr(page_table_t *table, seL4_Word vaddr)
     seL4_Word frame;
     seL4_Word offset;
     page_table_t *pt;
-    pt = (page_table_t *)get_n_level_table((seL4_Word)table, vaddr, 4);
+    pt = get_leaf_table(table, vaddr);
     /* we haven't got that vaddr yet */
     if (pt == NULL) {
         return 0;
     }
     offset = get_offset(vaddr, 4);
     frame = pt->page_obj_addr[offset];
-    return frame;
+    /* the cap is the page table's business */
+    return entry_cap(frame) ? entry_with_cap(frame, seL4_CapNull) : frame;
 }
 
-seL4_Word get_sos_virtual_address(page_table_t *table, seL4_Word vaddr)
+seL4_Word get_sos_virtual_address(proc *process, seL4_Word vaddr, bool write)
 {
-    seL4_Word frame = _get_frame_from_vaddr(table, vaddr);
-    if (frame & PRESENT) {
-        frame = (int) frame;
-        return (FRAME_BASE + frame * PAGE_SIZE_4K) + (vaddr & PAGE_MASK_4K);
+    seL4_Word frame = _get_frame_from_vaddr(process->pt, vaddr);
+    if (!(frame & PRESENT)) {
+        return 0;
     }
-    return 0;
+    if (write && (frame & UNMAPPED)) {
+        /* it may be on its way out, the caller faults it back in like the
+         * process would, which the eviction sees as a use of the page */
+        return 0;
+    }
+    if (write && frame_nmappers(frame & OFFSET) > 1) {
+        /* merged with other pages, they must not see what SOS writes */
+        as_region *region = vaddr_get_region(process->as, vaddr);
+        if (region == NULL
+            || break_sharing(process, vaddr & PAGE_FRAME, frame, 0,
+                             seL4_CapRights_new(region->flags & RG_X, region->flags & RG_R,
+                                                region->flags & RG_W))) {
+            return 0;
+        }
+        return get_sos_virtual_address(process, vaddr, write);
+    }
+    frame = (int) frame;
+    if (write) {
+        /* the copy in swap goes stale behind the process's back */
+        swap_cache_drop(frame);
+        FRAME_SET_BIT(frame, CLOCK);
+    }
+    return (FRAME_BASE + frame * PAGE_SIZE_4K) + (vaddr & PAGE_MASK_4K);
 }
 
 void update_page_status(page_table_t *table, seL4_Word vaddr, bool present,
                         bool unmap, seL4_Word file_offset)
 {
-    page_table_t *pt = (page_table_t *)get_n_level_table((seL4_Word)table, vaddr,
-                       4);
-    // if(pt == NULL){
-    //     print_backtrace();
-    //     printf("%p\n", vaddr);
-    // }
-
-    // assert(pt);
+    page_table_t *pt = get_leaf_table(table, vaddr);
+    if (pt == NULL) {
+        /* the range went away while the page was on its way */
+        return;
+    }
     int offset = get_offset(vaddr, 4);
+    if (!present) {
+        /* the frame is going, its kept cap with it */
+        release_page_cap(pt, offset);
+    }
     if (unmap) {
         // clock hand will iterate through all the pages
         // set set the unmap bit
         pt->page_obj_addr[offset] |= UNMAPPED;
     }
     if (!present) {
-        pt->page_obj_addr[offset] = file_offset & (~PRESENT);
+        set_leaf_entry(pt, offset, file_offset & (~PRESENT));
     }
 
 
@@ -264,60 +830,206 @@ void update_page_status(page_table_t *table, seL4_Word vaddr, bool present,
 
 void destroy_page_table(page_table_t *table)
 {
-
-    page_table_cap *caps_1 = get_page_table_cap((seL4_Word)table);
-    page_table_ut *uts_1 = get_page_table_ut((seL4_Word)table);
     for (int i = 0; i < PAGE_TABLE_SIZE; i++) {
-        if (table->page_obj_addr[i] == 0) continue;
+        page_table_t *table_2 = NODE_TABLE(table->page_obj_addr[i]);
+        if (table_2 == NULL) continue;
 
-        page_table_t *table_2 = (page_table_t *) table->page_obj_addr[i];
-        page_table_cap *caps_2 = get_page_table_cap((seL4_Word)table_2);
-        page_table_ut *uts_2 = get_page_table_ut((seL4_Word)table_2);
         for (int j = 0; j < PAGE_TABLE_SIZE; j++) {
-            if (table_2->page_obj_addr[j] == 0) continue;
+            page_table_t *table_3 = NODE_TABLE(table_2->page_obj_addr[j]);
+            if (table_3 == NULL) continue;
 
-            page_table_t *table_3 = (page_table_t *) table_2->page_obj_addr[j];
-            page_table_cap *caps_3 = get_page_table_cap((seL4_Word)table_3);
-            page_table_ut *uts_3 = get_page_table_ut((seL4_Word)table_3);
             for (int k = 0; k < PAGE_TABLE_SIZE; k++) {
                 if (table_3->page_obj_addr[k] == 0) continue;
-                seL4_Word vaddr = table_3->page_obj_addr[k];
+                LEAF_RESIDENT(NODE_TABLE(table_3->page_obj_addr[k])) = 0;
+                frame_n_free(ENTRY_FRAME(table_3->page_obj_addr[k]));
+                destroy_pt_obj(table_3->page_obj_addr[k]);
+            }
 
-                frame_n_free((vaddr - FRAME_BASE) / PAGE_SIZE_4K);
+            frame_n_free(ENTRY_FRAME(table_2->page_obj_addr[j]));
+            destroy_pt_obj(table_2->page_obj_addr[j]);
+        }
 
-                seL4_CPtr cp = caps_3->cap[k];
-                cspace_delete(global_cspace, cp);
-                cspace_free_slot(global_cspace, cp);
+        frame_n_free(ENTRY_FRAME(table->page_obj_addr[i]));
+        destroy_pt_obj(table->page_obj_addr[i]);
+    }
 
-                ut_t *u = uts_3->ut[k];
-                ut_free(u, seL4_PageBits);
-            }
+    seL4_Word vaddr = (seL4_Word)table;
+
+    frame_n_free((vaddr - FRAME_BASE) / PAGE_SIZE_4K);
+}
+bool is_large_page(page_table_t *table, seL4_Word vaddr)
+{
+    page_table_t *pt = (page_table_t *)get_n_level_table((seL4_Word)table, vaddr, 3);
+    return pt && (pt->page_obj_addr[get_offset(vaddr, 3)] & LARGE_PAGE);
+}
+
+/* first frame table index of the large frame behind a LARGE_PAGE entry */
+static int large_page_frame(page_table_t *pt3, int offset)
+{
+    page_table_t *pt4 = NODE_TABLE(pt3->page_obj_addr[offset]);
+    return ENTRY_FRAME(pt4->page_obj_addr[0]);
+}
+
+static seL4_Error map_large_page(proc *cur_proc, page_table_t *pt3, int offset,
+                                 seL4_Word vaddr, seL4_CapRights_t rights)
+{
+    int frame = large_page_frame(pt3, offset);
 
-            seL4_Word vaddr = table_2->page_obj_addr[j];
+    seL4_CPtr cap = cspace_alloc_slot(global_cspace);
+    if (cap == seL4_CapNull) {
+        return seL4_NotEnoughMemory;
+    }
+    seL4_Error err = cspace_copy(global_cspace, cap, global_cspace,
+                                 frame_table.backing[frame].frame_cap, rights);
+    if (err) {
+        cspace_free_slot(global_cspace, cap);
+        return err;
+    }
+    err = seL4_ARM_Page_Map(cap, cur_proc->vspace, vaddr, rights,
+                            seL4_ARM_Default_VMAttributes);
+    if (err) {
+        cspace_delete(global_cspace, cap);
+        cspace_free_slot(global_cspace, cap);
+        return err;
+    }
+    entry_obj(pt3->page_obj_addr[offset])->cap = cap;
+    pt3->page_obj_addr[offset] &= ~UNMAPPED;
+    FRAME_CLEAR_BIT(frame, PIN);
+    FRAME_SET_BIT(frame, CLOCK);
+    return seL4_NoError;
+}
 
-            frame_n_free((vaddr - FRAME_BASE) / PAGE_SIZE_4K);
+/* take the 2M mapping out of the process, the shadow entry stays LARGE_PAGE */
+static void unmap_large_mapping(page_table_t *pt3, int offset)
+{
+    pt_obj *o = entry_obj(pt3->page_obj_addr[offset]);
+    if (!(pt3->page_obj_addr[offset] & UNMAPPED)) {
+        seL4_ARM_Page_Unmap(o->cap);
+        cspace_delete(global_cspace, o->cap);
+        cspace_free_slot(global_cspace, o->cap);
+        pt3->page_obj_addr[offset] |= UNMAPPED;
+    }
+    o->cap = seL4_CapNull;
+}
 
-            seL4_CPtr cp = caps_2->cap[j];
-            cspace_delete(global_cspace, cp);
-            cspace_free_slot(global_cspace, cp);
+seL4_Error remap_large_page(proc *cur_proc, seL4_Word vaddr, seL4_CapRights_t rights)
+{
+    page_table_t *pt3 = (page_table_t *)get_n_level_table((seL4_Word)cur_proc->pt, vaddr, 3);
+    int offset = get_offset(vaddr, 3);
+    if (!(pt3->page_obj_addr[offset] & UNMAPPED)) {
+        return seL4_RangeError;
+    }
+    return map_large_page(cur_proc, pt3, offset, vaddr & ~(LARGE_PAGE_SIZE - 1), rights);
+}
 
-            ut_t *u = uts_2->ut[j];
-            ut_free(u, seL4_PageBits);
-        }
+void unmap_large_page(proc *process, seL4_Word vaddr)
+{
+    page_table_t *pt3 = (page_table_t *)get_n_level_table((seL4_Word)process->pt, vaddr, 3);
+    unmap_large_mapping(pt3, get_offset(vaddr, 3));
+}
 
-        seL4_Word vaddr = table->page_obj_addr[i];
+/* every 4K page of the range is resident and none of them is pinned by SOS */
+static bool large_range_resident(page_table_t *pt4)
+{
+    if (LEAF_RESIDENT(pt4) < PAGE_TABLE_SIZE) {
+        return false;
+    }
+    for (int i = 0; i < PAGE_TABLE_SIZE; i++) {
+        seL4_Word entry = pt4->page_obj_addr[i];
+        if (!(entry & PRESENT) || FRAME_GET_BIT(ENTRY_FRAME(entry), PIN)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-        frame_n_free((vaddr - FRAME_BASE) / PAGE_SIZE_4K);
+seL4_Error promote_large_page(proc *cur_proc, as_region *region, seL4_Word vaddr)
+{
+    seL4_Word base = vaddr & ~(LARGE_PAGE_SIZE - 1);
+    if (base < region->vaddr || base + LARGE_PAGE_SIZE > region->vaddr + region->size) {
+        return seL4_RangeError;
+    }
+    page_table_t *pt3 = (page_table_t *)get_n_level_table((seL4_Word)cur_proc->pt, base, 3);
+    if (pt3 == NULL) {
+        return seL4_RangeError;
+    }
+    int offset = get_offset(base, 3);
+    if (pt3->page_obj_addr[offset] & LARGE_PAGE) {
+        return seL4_NoError;
+    }
+    page_table_t *pt4 = NODE_TABLE(pt3->page_obj_addr[offset]);
+    if (pt4 == NULL || !large_range_resident(pt4)) {
+        return seL4_RangeError;
+    }
 
-        seL4_CPtr cp = caps_1->cap[i];
-        cspace_delete(global_cspace, cp);
-        cspace_free_slot(global_cspace, cp);
+    seL4_Word large_vaddr;
+    int large = frame_large_alloc(&large_vaddr);
+    if (large == -1) {
+        return seL4_NotEnoughMemory;
+    }
+    /* getting the frame may have swapped, look again */
+    if (!large_range_resident(pt4)) {
+        frame_large_free(large);
+        return seL4_RangeError;
+    }
 
-        ut_t *u = uts_1->ut[i];
-        ut_free(u, seL4_PageBits);
+    /* move every 4K page into the large frame */
+    for (int i = 0; i < PAGE_TABLE_SIZE; i++) {
+        int frame = ENTRY_FRAME(pt4->page_obj_addr[i]);
+        memcpy((void *)(large_vaddr + i * PAGE_SIZE_4K),
+               (void *)(FRAME_BASE + frame * PAGE_SIZE_4K), PAGE_SIZE_4K);
+        release_page_cap(pt4, i);
+        frame_rmap_remove(frame, cur_proc->status.pid, base + i * PAGE_SIZE_4K);
+        frame_free(frame);
+        set_leaf_entry(pt4, i, (large + i) | PRESENT);
+        frame_rmap_add(large + i, cur_proc->status.pid, base + i * PAGE_SIZE_4K);
     }
 
-    seL4_Word vaddr = (seL4_Word)table;
+    /* the hardware page table has to go before the 2M mapping can go in */
+    pt_obj *o = entry_obj(pt3->page_obj_addr[offset]);
+    seL4_ARM_PageTable_Unmap(o->cap);
+    cspace_delete(global_cspace, o->cap);
+    cspace_free_slot(global_cspace, o->cap);
+    ut_free(o->ut, seL4_PageBits);
+    o->cap = seL4_CapNull;
+    o->ut = NULL;
 
-    frame_n_free((vaddr - FRAME_BASE) / PAGE_SIZE_4K);
-}
\ No newline at end of file
+    /* if the mapping fails the entry stays unmapped and the next fault retries */
+    pt3->page_obj_addr[offset] |= LARGE_PAGE | UNMAPPED;
+    return map_large_page(cur_proc, pt3, offset, base,
+                          seL4_CapRights_new(region->flags & RG_X, region->flags & RG_R,
+                                             region->flags & RG_W));
+}
+
+int demote_large_page(proc *process, seL4_Word vaddr)
+{
+    page_table_t *pt3 = (page_table_t *)get_n_level_table((seL4_Word)process->pt, vaddr, 3);
+    int offset = get_offset(vaddr, 3);
+    int frame = large_page_frame(pt3, offset);
+    unmap_large_mapping(pt3, offset);
+    pt3->page_obj_addr[offset] &= ~(LARGE_PAGE | UNMAPPED);
+    return frame;
+}
+
+void restore_large_page(proc *process, seL4_Word vaddr, int frame)
+{
+    page_table_t *pt3 = (page_table_t *)get_n_level_table((seL4_Word)process->pt, vaddr, 3);
+    int offset = get_offset(vaddr, 3);
+    page_table_t *pt4 = NODE_TABLE(pt3->page_obj_addr[offset]);
+    for (int i = 0; i < PAGE_TABLE_SIZE; i++) {
+        release_page_cap(pt4, i);
+        set_leaf_entry(pt4, i, (frame + i) | PRESENT);
+    }
+    /* mapped again by the next fault on it */
+    pt3->page_obj_addr[offset] |= LARGE_PAGE | UNMAPPED;
+}
+
+void destroy_large_page(proc *process, seL4_Word vaddr)
+{
+    page_table_t *pt4 = get_leaf_table(process->pt, vaddr);
+    int frame = demote_large_page(process, vaddr);
+    for (int i = 0; i < PAGE_TABLE_SIZE; i++) {
+        set_leaf_entry(pt4, i, 0);
+    }
+    frame_large_free(frame);
+}
@@ -7,15 +7,33 @@
 /*
  * 4 level shadow page talbe
  * keep track of capabilities of
- * hardware page table
+ * hardware page table, one frame per table
 */
 
 #define PAGE_TABLE_SIZE 512
-#define PAGE_TABLE_FRAME_SIZE 3
+#define PAGE_TABLE_FRAME_SIZE 1
 #define PAGE_FRAME 0xfffffffffffff000
 
+/*
+ * flags of a level 4 entry, above the frame or swap offset in OFFSET.
+ * with PRESENT clear and ZERO_PAGE set the page reads as zeros, it was
+ * evicted holding nothing else. without UNMAPPED the shared zero frame is
+ * mapped read-only there.
+ */
+#define OFFSET    0xffffffffffff
+#define ZERO_PAGE (1lu << 48)
+#define PRESENT   (1lu << 50)
+#define PAGE_RW   (1lu << 51)
+#define UNMAPPED  (1lu << 52)
+/*
+ * the whole entry of a page on its way to swap that has no slot yet, it
+ * holds no frame, cap or offset. faults on it wait for the transfer
+ */
+#define IN_TRANSIT (1lu << 54)
+
 typedef struct page_table page_table_t;
 typedef struct proc proc;
+typedef struct as_region as_region;
 
 
 typedef struct page_table_entry {
@@ -34,6 +52,19 @@ page_table_t *initialize_page_table(void);
 
 void destroy_page_table(page_table_t *table);
 
+/*
+ * call fn for the pages between start and end that have an entry, in runs
+ * of pages next to each other in one level 4 table. subtrees without any
+ * table are passed over whole. fn may change the entries of its run, but
+ * must leave the tables alone
+ */
+typedef void (*page_run_fn)(proc *process, seL4_Word vaddr, unsigned npages, void *arg);
+void page_range_walk(proc *process, seL4_Word start, seL4_Word end,
+                     page_run_fn fn, void *arg);
+
+/* free the shadow and hardware tables between start and end left with no pages */
+void page_range_trim(page_table_t *table, seL4_Word start, seL4_Word end);
+
 /*
  * page fault handler
  * @param cur_proc     current process that triggered the page fault
@@ -57,6 +88,14 @@ seL4_Error handle_page_fault(proc *cur_proc, seL4_Word vaddr,
 seL4_Error insert_page_table_entry(page_table_t *table, page_table_entry *entry,
                                    int level, seL4_Word vaddr);
 
+/*
+ * undo insert_page_table_entry when the mapping fails further down, the
+ * caller deletes the hardware table and frees the shadow one. with keep the
+ * entry was there before (a demoted large page leaves its level 4 shadow
+ * table behind) and only forgets the hardware table
+ */
+void remove_page_table_entry(page_table_t *table, int level, seL4_Word vaddr, bool keep);
+
 /*
  * update the 4th level page table entry
  * when there is no error happened after calling seL4_ARM_Page_Map
@@ -70,6 +109,31 @@ seL4_Error insert_page_table_entry(page_table_t *table, page_table_entry *entry,
 void update_level_4_page_table_entry(page_table_t *table,
                                      page_table_entry *entry, seL4_Word vaddr);
 
+/*
+ * shadow table at the given level (2, 3 or 4) covering vaddr
+ *
+ * return the address of the table, 0 if it does not exist yet
+ */
+seL4_Word get_shadow_page_table(page_table_t *table, seL4_Word vaddr, int level);
+
+/*
+ * 2M large pages
+ *
+ * promote_large_page replaces the 512 resident 4K pages of the aligned 2M range
+ * around vaddr with one large frame, if the range lies inside the region.
+ * demote_large_page takes the mapping away and turns the range back into 4K
+ * pages without freeing anything, returning the large frame so the caller can
+ * move its contents out. destroy_large_page throws the range away.
+ */
+bool is_large_page(page_table_t *table, seL4_Word vaddr);
+seL4_Error promote_large_page(proc *cur_proc, as_region *region, seL4_Word vaddr);
+seL4_Error remap_large_page(proc *cur_proc, seL4_Word vaddr, seL4_CapRights_t rights);
+void unmap_large_page(proc *process, seL4_Word vaddr);
+int demote_large_page(proc *process, seL4_Word vaddr);
+/* undo demote_large_page, frame still holds every 4K piece of the range */
+void restore_large_page(proc *process, seL4_Word vaddr, int frame);
+void destroy_large_page(proc *process, seL4_Word vaddr);
+
 /* some help functions to get slot / frame from vaddr */
 seL4_CPtr get_cap_from_vaddr(page_table_t *table, seL4_Word vaddr);
 seL4_Word get_frame_from_vaddr(page_table_t *table, seL4_Word vaddr);
@@ -77,12 +141,16 @@ seL4_Word _get_frame_from_vaddr(page_table_t *table, seL4_Word vaddr);
 
 /*
  * convert a user-level virtual address to SOS's virtual address
- * @param table        user-level page table
+ * @param process      process owning the address
  * @param vaddr        user-level virtual address
+ * @param write        SOS is going to write to the page, a frame shared
+ *                     with other pages gets copied first and a clean
+ *                     copy of it in swap is forgotten
  *
- * return SOS's virtual address
+ * return SOS's virtual address, 0 if the page has to be faulted in first.
+ * a page the clock unmapped has to be faulted in again before SOS writes
  */
-seL4_Word get_sos_virtual_address(page_table_t *table, seL4_Word vaddr);
+seL4_Word get_sos_virtual_address(proc *process, seL4_Word vaddr, bool write);
 
 
 /*
@@ -95,13 +163,49 @@ seL4_Word get_sos_virtual_address(page_table_t *table, seL4_Word vaddr);
  */
 seL4_Error load_page(proc *process, seL4_Word vaddr, seL4_Word sos_frame_vaddr);
 
+/*
+ * a transfer to or from the swapping file is under way for the page, the
+ * faults on it wait for it with swap_wait (an error if aborted meanwhile)
+ */
+bool swap_in_transit(proc *process, seL4_Word vaddr);
+seL4_Error swap_wait(proc *process, seL4_Word vaddr);
+
 void update_page_status(page_table_t *table, seL4_Word vaddr, bool present,
                         bool unmap, seL4_Word file_offset);
 
-void initialize_swapping_file(void);
+/* vaddr reads as zeros through cap, a mapping of the shared zero frame */
+void map_zero_page(page_table_t *table, seL4_Word vaddr, seL4_CPtr cap);
+
+/* point vaddr at a frame that is in memory but not mapped yet */
+void stage_page(page_table_t *table, seL4_Word vaddr, int frame);
+
+/*
+ * caps of 4K user pages
+ *
+ * the clock only takes the mapping away with unmap_page, the entry keeps
+ * its cap and remap_page maps that again on the next fault, an error if
+ * there is none to map. drop_page_cap lets the cap go for good, unmapping
+ * it if needed, whenever the entry stops referring to its frame.
+ */
+void unmap_page(page_table_t *table, seL4_Word vaddr);
+seL4_Error remap_page(proc *cur_proc, seL4_Word vaddr, seL4_CapRights_t rights);
+void drop_page_cap(page_table_t *table, seL4_Word vaddr);
+
+/* the frame got written, forget the copy of it still in swap */
+void swap_cache_drop(int frame);
+
+/* a read-around page got used / was thrown away unused, tunes the window */
+void prefetch_hit(proc *process);
+void prefetch_wasted(proc *process);
 
 seL4_Error try_swap_out(void);
+/* write out one page of the process, used once it is at its rss limit */
+seL4_Error swap_out_process(proc *process);
 
 void page_table_destroy(page_table_t *table);
 
-void clean_up_swapping(unsigned offset);
\ No newline at end of file
+/* the page behind a non-present entry is gone, in the pool or in the file */
+void clean_up_swapping(seL4_Word entry);
+
+/* slots of the swapping file holding pages, and how many it has */
+void swap_stat(unsigned *used, unsigned *total);
\ No newline at end of file
@@ -20,6 +20,8 @@
 #include <string.h>
 
 #define DEFAULT_PRIORITY (0)
+/* ms over which the fault rate of a process is taken */
+#define PROC_PFF_WINDOW 1000
 
 static proc process_array[PROCESS_ARRAY_SIZE];
 
@@ -62,6 +64,12 @@ proc *get_process(int pid)
     return &process_array[index];
 }
 
+proc *get_live_process(int pid)
+{
+    proc *process = get_process(pid);
+    return process->status.pid == pid && process->pt ? process : NULL;
+}
+
 /* helper to allocate a ut + cslot, and retype the ut into the cslot */
 static ut_t *alloc_retype(seL4_CPtr *cptr, seL4_Word type, size_t size_bits)
 {
@@ -213,7 +221,7 @@ static uintptr_t init_process_stack(int pid, cspace_t *cspace, char *elf_file,
  * TODO: avoid leaking memory once you implement real processes, otherwise a user
  *       can force your OS to run out of memory by creating lots of failed processes.
  */
-bool start_process(char *app_name, seL4_CPtr ep, int *ret_pid)
+bool start_process(char *app_name, seL4_CPtr ep, unsigned rss_limit, int *ret_pid)
 {
     int frame;
     int pid = get_next_available_pid();
@@ -223,6 +231,20 @@ bool start_process(char *app_name, seL4_CPtr ep, int *ret_pid)
     proc *process = get_process(pid);
     process->status.pid = pid;
     process->status.size = 0;
+    process->rss = 0;
+    process->rss_limit = rss_limit;
+    process->prefetch_window = 1;
+    process->last_swapin = 0;
+    process->status.rss = 0;
+    process->status.wss = 0;
+    process->status.pff = 0;
+    process->status.minflt = 0;
+    process->status.majflt = 0;
+    process->status.zeroflt = 0;
+    process->status.evictions = 0;
+    process->window_start = get_now_since_boot();
+    process->window_faults = 0;
+    process->ws_seen = 0;
 
 
     // printf("load elf\n");
@@ -306,9 +328,9 @@ bool start_process(char *app_name, seL4_CPtr ep, int *ret_pid)
     }
 
     /* now mutate the cap, thereby setting the badge */
-    /* badge is process id */
+    /* badge is process id, tagged so it can never be 0 */
     err = cspace_mint(&(process->cspace), user_ep, global_cspace, ep,
-                      seL4_AllRights, pid);
+                      seL4_AllRights, PROCESS_EP_BADGE | pid);
     if (err) {
         ZF_LOGE("Failed to mint user ep");
         return false;
@@ -418,6 +440,7 @@ void kill_process(int pid)
 
     // printf("try destroy pt\n");
     if (process->pt) destroy_page_table(process->pt);
+    process->pt = NULL;
 
     // printf("try destroy ft\n");
     if (process->openfile_table) filetable_destroy(process->openfile_table);
@@ -454,6 +477,7 @@ void kill_process(int pid)
     }
     process->state = DEAD;
     process->status.size = 0;
+    process->rss = 0;
     // process->status.pid = -1;
     process->status.stime = 0;
     process->waiting_pid = -99;
@@ -461,4 +485,35 @@ void kill_process(int pid)
     process->reply = seL4_CapNull;
     kill_lock = 0;
     // printf("all done\n");
-}
\ No newline at end of file
+}
+
+unsigned proc_fair_share(void)
+{
+    unsigned total = 0, n = 0;
+    for (int i = 0; i < PROCESS_ARRAY_SIZE; ++i) {
+        if (process_array[i].state != DEAD) {
+            total += process_array[i].rss;
+            n++;
+        }
+    }
+    return n ? total / n : 0;
+}
+
+void proc_fault(proc *process)
+{
+    unsigned now = get_now_since_boot();
+    process->window_faults++;
+    if (now - process->window_start >= PROC_PFF_WINDOW) {
+        process->status.pff = process->window_faults * 1000ul / (now - process->window_start);
+        process->window_faults = 0;
+        process->window_start = now;
+    }
+}
+
+void proc_sweep_done(void)
+{
+    for (int i = 0; i < PROCESS_ARRAY_SIZE; ++i) {
+        process_array[i].status.wss = process_array[i].ws_seen;
+        process_array[i].ws_seen = 0;
+    }
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <autoconf.h>
 #include <cspace/cspace.h>
 #include <stdbool.h>
 
@@ -8,6 +9,15 @@
 #define N_NAME 32
 #define PROCESS_ARRAY_SIZE 32
 
+/* resident frames a process may hold before it swaps out its own, 0 for none */
+#ifndef PROC_RSS_LIMIT
+#ifdef CONFIG_SOS_RSS_LIMIT
+#define PROC_RSS_LIMIT CONFIG_SOS_RSS_LIMIT
+#else
+#define PROC_RSS_LIMIT 0
+#endif
+#endif
+
 #define GET_BIT(number, bit) (((number) >> (bit)) & 1)
 #define SET_BIT(number, bit) ((number) |= (1 << (bit)))
 #define RST_BIT(number, bit) ((number) &= ~(1 << (bit)))
@@ -26,6 +36,13 @@ typedef struct {
     unsigned  size;            /* in pages */
     unsigned  stime;           /* start time in msec since booting */
     char      command[N_NAME]; /* Name of exectuable */
+    unsigned  rss;             /* pages in memory */
+    unsigned  wss;             /* pages used over the last clock sweeps, 0 before the first */
+    unsigned  pff;             /* faults per second over the last window */
+    unsigned long minflt;      /* faults mapping a page still in memory */
+    unsigned long majflt;      /* faults reading a page back from swap */
+    unsigned long zeroflt;     /* faults on pages of zeros */
+    unsigned long evictions;   /* pages the clock took away */
 } sos_process_t;
 
 typedef struct proc {
@@ -40,6 +57,17 @@ typedef struct proc {
     filetable *openfile_table;
     seL4_CPtr user_endpoint;
     sos_process_t status;
+    /* frames mapped into the process that are in memory */
+    unsigned rss;
+    unsigned rss_limit;
+    /* pages a swap-in fault reads, and where the last one was */
+    unsigned prefetch_window;
+    seL4_Word last_swapin;
+    /* faults since the fault rate window opened at window_start (ms) */
+    unsigned window_start;
+    unsigned window_faults;
+    /* recently used pages the clock came across in the current sweep */
+    unsigned ws_seen;
     int waiting_pid;
     enum process_state state;
     struct coro *c;
@@ -62,5 +90,23 @@ proc *get_cur_proc(void);
 
 proc *get_process(int pid);
 
-bool start_process(char *app_name, seL4_CPtr ep, int *ret_pid);
-void kill_process(int pid);
\ No newline at end of file
+/*
+ * the process pid still names, NULL once it has been killed. whoever holds
+ * on to a process across a yield looks it up again with this afterwards
+ */
+proc *get_live_process(int pid);
+
+bool start_process(char *app_name, seL4_CPtr ep, unsigned rss_limit, int *ret_pid);
+void kill_process(int pid);
+
+/* resident frames of all live processes split evenly between them */
+unsigned proc_fair_share(void);
+
+/*
+ * every fault of the process goes through here to keep status.pff, which
+ * eviction policies may use to tell a thrashing process from an idle one
+ */
+void proc_fault(proc *process);
+
+/* the clock hand went round once, ws_seen becomes each process's status.wss */
+void proc_sweep_done(void);
\ No newline at end of file
@@ -0,0 +1,270 @@
+#include "replace.h"
+#include "frametable.h"
+#include "proc.h"
+#include <autoconf.h>
+#include <stdlib.h>
+#include <utils/util.h>
+
+/* frames a selection passes per victim before it settles for what it has */
+#ifndef REPLACE_SCAN
+#ifdef CONFIG_SOS_REPLACE_SCAN
+#define REPLACE_SCAN CONFIG_SOS_REPLACE_SCAN
+#else
+#define REPLACE_SCAN 32
+#endif
+#endif
+/* the lists policy keeps this fraction of the frames inactive */
+#define INACTIVE_RATIO 3
+
+static unsigned frames_total(void)
+{
+    return frame_table.max + 1 - first_available_frame;
+}
+
+/*
+ * the next unpinned frame at or after *hand, which is left on it. pinned
+ * frames are passed a bitmap word at a time, every frame passed comes off
+ * *left. -1 once that runs out, *lapped is set when the hand starts over
+ */
+static int hand_next(unsigned *hand, unsigned *left, bool *lapped)
+{
+    while (*left) {
+        if (*hand < first_available_frame || *hand > (unsigned)frame_table.max) {
+            *hand = first_available_frame;
+            *lapped = true;
+        }
+        unsigned bit = *hand % FRAME_WORD_BITS;
+        unsigned long unpinned = ~frame_table.pin[*hand / FRAME_WORD_BITS] & (~0ul << bit);
+        unsigned skip = unpinned ? CTZL(unpinned) - bit : FRAME_WORD_BITS - bit;
+        if (skip == 0) {
+            (*left)--;
+            return *hand;
+        }
+        *hand += skip;
+        *left -= MIN(skip, *left);
+    }
+    return -1;
+}
+
+/*
+ * a selection may pass two laps, but past REPLACE_SCAN frames per victim it
+ * stops as soon as it has one
+ */
+static bool scan_done(unsigned left, unsigned hard, unsigned max, unsigned n)
+{
+    return n == max || left == 0 || (hard - left >= REPLACE_SCAN * max && n > 0);
+}
+
+/* cold pages of small processes are passed over on the first lap */
+static bool spare(int frame, int owner, unsigned left, unsigned hard, unsigned share)
+{
+    return owner < 0 && hard - left < frames_total() && page_spared(frame, share);
+}
+
+static unsigned clock_hand;
+
+static unsigned clock_select(int owner, int *victims, unsigned max)
+{
+    unsigned share = proc_fair_share();
+    unsigned hard = 2 * frames_total(), left = hard, n = 0;
+    bool lapped = false;
+    int frame;
+
+    while (!scan_done(left, hard, max, n)
+           && (frame = hand_next(&clock_hand, &left, &lapped)) != -1) {
+        if (lapped) {
+            page_lap();
+            lapped = false;
+        }
+        clock_hand++;
+        page_seen(frame);
+        if (!page_candidate(frame, owner)) {
+            continue;
+        }
+        if (FRAME_GET_BIT(frame, CLOCK)) {
+            // second chance, the next use faults it back in
+            page_age(frame);
+        } else if (spare(frame, owner, left, hard, share)) {
+            // cold, but its owner is under its share, try the others first
+        } else if (page_evict(frame, victims, &n)) {
+            break;
+        }
+    }
+    return n;
+}
+
+static unsigned front_hand, back_hand;
+
+static unsigned hand_pos(unsigned hand)
+{
+    if (hand < first_available_frame || hand > (unsigned)frame_table.max) {
+        return first_available_frame;
+    }
+    return hand;
+}
+
+/* the front hand goes on until it's a quarter of the table ahead again */
+static void front_catch_up(int owner)
+{
+    unsigned total = frames_total();
+    unsigned spread = MAX(total / 4, 1u);
+    unsigned left = total;
+    bool lapped = false;
+    int frame;
+
+    while ((hand_pos(front_hand) + total - hand_pos(back_hand)) % total < spread
+           && (frame = hand_next(&front_hand, &left, &lapped)) != -1) {
+        front_hand++;
+        if (page_candidate(frame, owner) && FRAME_GET_BIT(frame, CLOCK)) {
+            page_age(frame);
+        }
+    }
+}
+
+static unsigned twohand_select(int owner, int *victims, unsigned max)
+{
+    unsigned share = proc_fair_share();
+    unsigned hard = 2 * frames_total(), left = hard, n = 0;
+    bool lapped = false;
+    int frame;
+
+    while (!scan_done(left, hard, max, n)
+           && (frame = hand_next(&back_hand, &left, &lapped)) != -1) {
+        if (lapped) {
+            page_lap();
+            lapped = false;
+        }
+        back_hand++;
+        front_catch_up(owner);
+        page_seen(frame);
+        if (!page_candidate(frame, owner) || FRAME_GET_BIT(frame, CLOCK)) {
+            // used again since the front hand went by
+            continue;
+        }
+        if (spare(frame, owner, left, hard, share)) {
+            continue;
+        }
+        if (page_evict(frame, victims, &n)) {
+            break;
+        }
+    }
+    return n;
+}
+
+/* a set bit is a frame on the inactive list */
+static unsigned long *inactive;
+static unsigned ninactive;
+static unsigned active_hand, inactive_hand;
+
+#define INACTIVE_WORD(x) (inactive[(x) / FRAME_WORD_BITS])
+#define INACTIVE_MASK(x) (1ul << ((x) % FRAME_WORD_BITS))
+
+static void set_inactive(int frame, bool on)
+{
+    if (on && !(INACTIVE_WORD(frame) & INACTIVE_MASK(frame))) {
+        INACTIVE_WORD(frame) |= INACTIVE_MASK(frame);
+        ninactive++;
+    } else if (!on && (INACTIVE_WORD(frame) & INACTIVE_MASK(frame))) {
+        INACTIVE_WORD(frame) &= ~INACTIVE_MASK(frame);
+        ninactive--;
+    }
+}
+
+/* move one active page to the inactive list, false if the hand found none */
+static bool deactivate_one(int owner, unsigned *left)
+{
+    bool lapped = false;
+    int frame;
+
+    while ((frame = hand_next(&active_hand, left, &lapped)) != -1) {
+        active_hand++;
+        if (page_candidate(frame, owner) && !(INACTIVE_WORD(frame) & INACTIVE_MASK(frame))) {
+            page_age(frame);
+            set_inactive(frame, true);
+            return true;
+        }
+    }
+    return false;
+}
+
+static unsigned lists_select(int owner, int *victims, unsigned max)
+{
+    unsigned total = frames_total(), share = proc_fair_share();
+    unsigned target = MAX(total / INACTIVE_RATIO, max);
+    unsigned hard = 2 * total, left = hard, n = 0;
+    /* the active hand gets its own two laps */
+    unsigned age_left = hard;
+    bool lapped = false, starved = false;
+    int frame;
+
+    if (inactive == NULL) {
+        inactive = calloc(FRAME_BITMAP_WORDS(frame_table.length), sizeof(unsigned long));
+        if (inactive == NULL) {
+            return 0;
+        }
+    }
+    while (!scan_done(left, hard, max, n)) {
+        // the inactive list is where victims come from, it's topped up a
+        // couple of pages per step so no selection ages a third of memory
+        unsigned want = starved ? max : ninactive < target ? 2 : 0;
+        for (unsigned i = 0; i < want; ++i) {
+            if (!deactivate_one(owner, &age_left)) {
+                break;
+            }
+        }
+        starved = false;
+        if ((frame = hand_next(&inactive_hand, &left, &lapped)) == -1) {
+            break;
+        }
+        if (lapped) {
+            page_lap();
+            lapped = false;
+            // a whole lap and nothing, the inactive pages must be someone else's
+            starved = n == 0;
+        }
+        inactive_hand++;
+        page_seen(frame);
+        if (!(INACTIVE_WORD(frame) & INACTIVE_MASK(frame))) {
+            continue;
+        }
+        if (FRAME_GET_BIT(frame, CLOCK)) {
+            // used again while inactive, back to the active list
+            set_inactive(frame, false);
+            continue;
+        }
+        if (!page_candidate(frame, owner) || spare(frame, owner, left, hard, share)) {
+            continue;
+        }
+        set_inactive(frame, false);
+        if (page_evict(frame, victims, &n)) {
+            break;
+        }
+    }
+    return n;
+}
+
+void replace_forget(int frame)
+{
+    if (inactive != NULL) {
+        set_inactive(frame, false);
+    }
+}
+
+static const replace_policy policies[] = {
+    { "clock", clock_select },
+    { "twohand", twohand_select },
+    { "lists", lists_select },
+};
+
+#if defined(CONFIG_SOS_REPLACE_TWO_HAND)
+#define REPLACE_POLICY 1
+#elif defined(CONFIG_SOS_REPLACE_LISTS)
+#define REPLACE_POLICY 2
+#else
+#define REPLACE_POLICY 0
+#endif
+
+unsigned replace_select(int owner, int *victims, unsigned max)
+{
+    return policies[REPLACE_POLICY].select(owner, victims, max);
+}
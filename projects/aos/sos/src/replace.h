@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+
+/*
+ * page replacement for swap_out. a policy walks the frame table with its
+ * hands and picks the victims, SosReplacePolicy chooses one at build time:
+ *
+ *   clock     one hand giving referenced pages a second chance
+ *   twohand   a front hand clearing references a quarter of the table
+ *             ahead of a back hand taking what wasn't used in between
+ *   lists     active and inactive pages. only pages moving to the inactive
+ *             list get unmapped to see if they are used again, the rest
+ *             stay mapped and cost no faults
+ *
+ * a policy passes about REPLACE_SCAN frames per victim it is asked for,
+ * and only goes on past that, for two laps at most, while it has none.
+ */
+typedef struct replace_policy {
+    const char *name;
+    /* up to max victims for swap_out_victims, only owner's if owner >= 0 */
+    unsigned (*select)(int owner, int *victims, unsigned max);
+} replace_policy;
+
+unsigned replace_select(int owner, int *victims, unsigned max);
+
+/* the frame stopped holding a user page, the policy forgets what it knew */
+void replace_forget(int frame);
+
+/* what the hands do to the frames they come across, from swap.c */
+
+/* an unpinned frame a hand of a selection for owner may act on */
+bool page_candidate(int frame, int owner);
+/* the evicting hand came by, the frame counts toward its owner's working set */
+void page_seen(int frame);
+/* the evicting hand went round once */
+void page_lap(void);
+/* the frame's owner holds less than share frames, its cold pages go last */
+bool page_spared(int frame, unsigned share);
+/* clear the reference and take the mappings away, the next use faults */
+void page_age(int frame);
+/*
+ * victims[(*n)++] = frame, unmapped, pinned and referenced for the eviction.
+ * a large frame is split and written out instead, non-zero if that failed
+ */
+int page_evict(int frame, int *victims, unsigned *n);
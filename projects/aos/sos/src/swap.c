@@ -1,224 +1,882 @@
 #include "frametable.h"
 #include "pagetable.h"
 #include "proc.h"
+#include "vmstat.h"
+#include "replace.h"
+#include "zswap.h"
 #include "vfs/vfs.h"
 #include "vfs/vnode.h"
 #include "vfs/uio.h"
+#include <autoconf.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
 #include <sel4/sel4.h>
 #include <picoro/picoro.h>
 #include "backtrace.h"
 
-static struct vnode *swap_file = NULL;
-static unsigned header = 0;
-static unsigned tail = 0;
-static unsigned clock_hand;
-static int volatile swap_lock = 0;
+/*
+ * the swapping files are preallocated to SWAP_SLOTS pages between them and
+ * which of them hold a page is only kept here, so each page in or out is one
+ * transfer
+ */
+#ifndef SWAP_SLOTS
+#ifdef CONFIG_SOS_SWAP_SLOTS
+#define SWAP_SLOTS CONFIG_SOS_SWAP_SLOTS
+#else
+#define SWAP_SLOTS 8192
+#endif
+#endif
+/* most pages a swap-in fault reads in one go */
+#ifndef SWAP_PREFETCH
+#ifdef CONFIG_SOS_SWAP_PREFETCH
+#define SWAP_PREFETCH CONFIG_SOS_SWAP_PREFETCH
+#else
+#define SWAP_PREFETCH 8
+#endif
+#endif
+/* victims collected by one sweep of the clock and written out together */
+#ifndef SWAP_CLUSTER
+#ifdef CONFIG_SOS_SWAP_CLUSTER
+#define SWAP_CLUSTER CONFIG_SOS_SWAP_CLUSTER
+#else
+#define SWAP_CLUSTER 8
+#endif
+#endif
+/* transfers to and from the swapping file in flight at once */
+#ifndef SWAP_IO_DEPTH
+#ifdef CONFIG_SOS_SWAP_IO_DEPTH
+#define SWAP_IO_DEPTH CONFIG_SOS_SWAP_IO_DEPTH
+#else
+#define SWAP_IO_DEPTH 4
+#endif
+#endif
+#define SWAP_WORD_BITS (sizeof(unsigned long) * CHAR_BIT)
+#define SWAP_WORDS ((SWAP_SLOTS + SWAP_WORD_BITS - 1) / SWAP_WORD_BITS)
+/* the swap area is striped over this many files, each its own NFS handle */
+#ifndef SWAP_FILES
+#ifdef CONFIG_SOS_SWAP_FILES
+#define SWAP_FILES CONFIG_SOS_SWAP_FILES
+#else
+#define SWAP_FILES 4
+#endif
+#endif
+#define SWAP_IO_PAGES MAX_UNSAFE(SWAP_CLUSTER, SWAP_PREFETCH)
+/*
+ * slots go round the files a stripe at a time. no transfer is longer than
+ * a stripe or crosses into the next, so each one goes to a single file
+ */
+#define SWAP_STRIPE SWAP_IO_PAGES
+#define SWAP_FILE_PAGES (DIV_ROUND_UP(SWAP_SLOTS, SWAP_STRIPE * SWAP_FILES) * SWAP_STRIPE)
+/* a page referenced within this many sweeps of the clock is in the working set */
+#define WSS_SWEEPS 4
 
-#define OFFSET 0xffffffffffff
+/* a coroutine waiting for the pages of a transfer */
+typedef struct swap_waiter {
+    struct swap_waiter *next;
+    bool done;
+} swap_waiter;
 
-int get_header(void)
+/*
+ * a transfer in flight, it lives on the stack of the coroutine doing it.
+ * while it is tracked, faults on its npages pages of pid from vaddr on
+ * queue up on waiters instead of starting another transfer of their own
+ */
+typedef struct swap_io {
+    struct swap_io *next;
+    seL4_Word vaddr;
+    unsigned npages;
+    uint8_t pid;
+    char *buf;
+    swap_waiter *waiters;
+} swap_io;
+
+static struct vnode *swap_files[SWAP_FILES];
+static bool volatile swap_opening = false;
+/* times the evicting hand went round, as far as ref_sweep can tell */
+static uint8_t sweep;
+/* a set bit is a slot in use */
+static unsigned long slot_map[SWAP_WORDS];
+/* a set bit is a slot being read, it is not handed out again until done */
+static unsigned long slot_busy[SWAP_WORDS];
+/* pages still referring to each slot, a shared frame is written out once */
+static uint8_t slot_refs[SWAP_SLOTS];
+static unsigned slots_used = 0;
+static swap_io *in_transit = NULL;
+static unsigned ios_in_flight = 0;
+/*
+ * victims that are not next to each other are gathered into a buffer for
+ * one write, and a read-around lands in one before it is copied into its
+ * frames. there is one for every transfer that may be in flight
+ */
+static char io_bufs[SWAP_IO_DEPTH][SWAP_IO_PAGES * PAGE_SIZE_4K];
+static bool io_buf_taken[SWAP_IO_DEPTH];
+
+/* grab n free slots in a row, first fit, -1 if there is no such run */
+static int slot_alloc_run(unsigned n)
 {
-    return header;
+    unsigned run = 0;
+    for (unsigned slot = 0; slot < SWAP_SLOTS; ++slot) {
+        unsigned long word = slot_map[slot / SWAP_WORD_BITS] | slot_busy[slot / SWAP_WORD_BITS];
+        if (word == ~0ul) {
+            run = 0;
+            slot |= SWAP_WORD_BITS - 1;
+            continue;
+        }
+        if (slot % SWAP_STRIPE == 0) {
+            // a run doesn't cross into the next file
+            run = 0;
+        }
+        if (word & (1ul << (slot % SWAP_WORD_BITS))) {
+            run = 0;
+        } else if (++run == n) {
+            unsigned first = slot + 1 - n;
+            for (unsigned i = first; i <= slot; ++i) {
+                slot_map[i / SWAP_WORD_BITS] |= 1ul << (i % SWAP_WORD_BITS);
+                slot_refs[i] = 1;
+            }
+            slots_used += n;
+            return first;
+        }
+    }
+    return -1;
 }
 
-void initialize_swapping_file(void)
+/* the file holding slot, *pos is where in it */
+static struct vnode *slot_file(unsigned slot, size_t *pos)
 {
-    clock_hand = first_available_frame;
+    unsigned stripe = slot / SWAP_STRIPE;
+    *pos = ((size_t)(stripe / SWAP_FILES) * SWAP_STRIPE + slot % SWAP_STRIPE) * PAGE_SIZE_4K;
+    return swap_files[stripe % SWAP_FILES];
 }
 
-seL4_Error load_page(proc *process, seL4_Word vaddr, seL4_Word sos_frame_vaddr)
+static void slot_free(unsigned slot)
+{
+    slot_map[slot / SWAP_WORD_BITS] &= ~(1ul << (slot % SWAP_WORD_BITS));
+    slot_refs[slot] = 0;
+    slots_used--;
+}
+
+/* drop one reference on a slot, true if nobody needs it anymore */
+static bool slot_put(unsigned slot)
+{
+    if (slot_refs[slot] <= 1) {
+        slot_free(slot);
+        return true;
+    }
+    slot_refs[slot]--;
+    return false;
+}
+
+/*
+ * a page read back in keeps its slot while it stays clean, as long as no
+ * other page table entry still refers to the slot
+ */
+static void swap_cache_keep(int frame, unsigned slot)
+{
+    if (slot_refs[slot] == 1) {
+        frame_table.slot[frame] = slot + 1;
+    } else if (slot_refs[slot] > 1) {
+        slot_put(slot);
+    }
+    // no references left, the page was thrown away while it was read
+}
+
+static void slots_mark_busy(unsigned slot, unsigned n, bool busy)
+{
+    for (unsigned i = slot; i < slot + n; ++i) {
+        if (busy) {
+            slot_busy[i / SWAP_WORD_BITS] |= 1ul << (i % SWAP_WORD_BITS);
+        } else {
+            slot_busy[i / SWAP_WORD_BITS] &= ~(1ul << (i % SWAP_WORD_BITS));
+        }
+    }
+}
+
+/* faults on npages pages of process from vaddr on wait for io from now on */
+static void io_track(swap_io *io, proc *process, seL4_Word vaddr, unsigned npages)
+{
+    io->pid = process->status.pid;
+    io->vaddr = vaddr;
+    io->npages = npages;
+    io->waiters = NULL;
+    io->next = in_transit;
+    in_transit = io;
+}
+
+/* the pages of io are where they belong, wake everyone waiting for them */
+static void io_untrack(swap_io *io)
+{
+    swap_io **p = &in_transit;
+    while (*p != io) {
+        p = &(*p)->next;
+    }
+    *p = io->next;
+    for (swap_waiter *w = io->waiters; w; w = w->next) {
+        w->done = true;
+    }
+}
+
+static swap_io *io_find(proc *process, seL4_Word vaddr)
+{
+    for (swap_io *io = in_transit; io; io = io->next) {
+        if (io->pid == (uint8_t)process->status.pid && vaddr >= io->vaddr
+            && vaddr < io->vaddr + io->npages * PAGE_SIZE_4K) {
+            return io;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * take a place among the transfers in flight, with a buffer if asked for.
+ * false if the coroutine was aborted while it waited for one
+ */
+static bool io_start(swap_io *io, bool buffer)
 {
-    int result = 0;
-    struct uio k_uio;
-    unsigned tmp = 0;
     void *aborted = 0;
-    seL4_Word offset;
-    while (swap_lock == 1) {
+    while (ios_in_flight == SWAP_IO_DEPTH && !aborted) {
         aborted = yield(NULL);
     }
     if (aborted) {
-        swap_lock = 0;
+        return false;
+    }
+    ios_in_flight++;
+    io->buf = NULL;
+    for (unsigned i = 0; buffer && i < SWAP_IO_DEPTH; ++i) {
+        if (!io_buf_taken[i]) {
+            io_buf_taken[i] = true;
+            io->buf = io_bufs[i];
+            break;
+        }
+    }
+    return true;
+}
+
+static void io_end(swap_io *io)
+{
+    if (io->buf) {
+        io_buf_taken[(io->buf - io_bufs[0]) / sizeof(io_bufs[0])] = false;
+    }
+    ios_in_flight--;
+}
+
+bool swap_in_transit(proc *process, seL4_Word vaddr)
+{
+    return io_find(process, vaddr) != NULL;
+}
+
+seL4_Error swap_wait(proc *process, seL4_Word vaddr)
+{
+    swap_io *io = io_find(process, vaddr);
+    swap_waiter w = { NULL, false };
+    void *aborted = 0;
+
+    if (io == NULL) {
+        return seL4_NoError;
+    }
+    w.next = io->waiters;
+    io->waiters = &w;
+    while (!w.done && !aborted) {
+        aborted = yield(NULL);
+    }
+    if (!w.done) {
+        // the transfer is still going, it must not wake us anymore
+        swap_waiter **p = &io->waiters;
+        while (*p != &w) {
+            p = &(*p)->next;
+        }
+        *p = w.next;
         return seL4_IllegalOperation;
     }
-    swap_lock = 1;
+    return seL4_NoError;
+}
+
+void swap_cache_drop(int frame)
+{
+    unsigned slot = frame_table.slot[frame];
+    if (slot) {
+        frame_table.slot[frame] = 0;
+        slot_put(slot - 1);
+    }
+}
+
+void prefetch_hit(proc *process)
+{
+    vmstat_events.prefetch_hits++;
+    process->prefetch_window = MIN(process->prefetch_window * 2, (unsigned)SWAP_PREFETCH);
+}
+
+void prefetch_wasted(proc *process)
+{
+    vmstat_events.prefetch_waste++;
+    process->prefetch_window = MAX(process->prefetch_window / 2, 1u);
+}
+
+/*
+ * how many pages from vaddr on can come in with one read: the following
+ * pages of the process have to sit in the following slots of the same
+ * stripe, not be shared
+ * or already on their way in, and get a frame without anything else being
+ * swapped out for it
+ */
+static unsigned read_around(proc *process, seL4_Word vaddr, seL4_Word offset,
+                            int *frames)
+{
+    unsigned window = process->prefetch_window;
+    if (process->rss_limit) {
+        window = MIN(window, process->rss_limit > process->rss + 1 ?
+                     process->rss_limit - process->rss : 1);
+    }
+    unsigned n = 1;
+    for (; n < window; ++n) {
+        seL4_Word entry = _get_frame_from_vaddr(process->pt, vaddr + n * PAGE_SIZE_4K);
+        seL4_Word slot = offset / PAGE_SIZE_4K + n;
+        if (slot >= SWAP_SLOTS || slot % SWAP_STRIPE == 0 || entry == 0 || (entry & (PRESENT | ZSWAPPED))
+            || (entry & OFFSET) != slot * PAGE_SIZE_4K + 1 || slot_refs[slot] != 1
+            || (slot_busy[slot / SWAP_WORD_BITS] & (1ul << (slot % SWAP_WORD_BITS)))) {
+            break;
+        }
+        frames[n] = frame_alloc_noevict(NULL);
+        if (frames[n] == -1) {
+            break;
+        }
+    }
+    return n;
+}
+
+seL4_Error load_page(proc *process, seL4_Word vaddr, seL4_Word sos_frame_vaddr)
+{
+    int result = 0;
+    struct uio k_uio;
+    swap_io io;
+    seL4_Word offset;
+    size_t pos;
+    int frames[SWAP_PREFETCH];
+    unsigned n;
+    int pid = process->status.pid;
+
     offset = _get_frame_from_vaddr(process->pt, vaddr);
+    if (offset & ZSWAPPED) {
+        // still in memory, nothing around it is worth reading ahead
+        return zswap_load(offset, sos_frame_vaddr) ? seL4_IllegalOperation : seL4_NoError;
+    }
     // printf("load page start\n");
     offset &= OFFSET;
     --offset; // offset is 1 based in pagetable but 0 based in file
     // print_backtrace();
     // assert(false);
-    uio_kinit(&k_uio, sos_frame_vaddr, PAGE_SIZE_4K, offset, UIO_READ);
-    result = VOP_READ(swap_file, &k_uio);
-    if (result) {
-        swap_lock = 0;
-        return result;
+
+    // faulting on the page after the last one read in looks sequential
+    if (vaddr == process->last_swapin + PAGE_SIZE_4K && process->prefetch_window == 1) {
+        process->prefetch_window = 2;
+    }
+    process->last_swapin = vaddr;
+    // nothing up to here yields, so nobody else can have started on these
+    n = read_around(process, vaddr, offset, frames);
+    io_track(&io, process, vaddr, n);
+    slots_mark_busy(offset / PAGE_SIZE_4K, n, true);
+    if (!io_start(&io, n > 1)) {
+        slots_mark_busy(offset / PAGE_SIZE_4K, n, false);
+        for (unsigned i = 1; i < n; ++i) {
+            frame_free(frames[i]);
+        }
+        io_untrack(&io);
+        return seL4_IllegalOperation;
+    }
+    struct vnode *file = slot_file(offset / PAGE_SIZE_4K, &pos);
+    if (n == 1) {
+        uio_kinit(&k_uio, sos_frame_vaddr, PAGE_SIZE_4K, pos, UIO_READ);
+    } else {
+        uio_kinit(&k_uio, (seL4_Word)io.buf, n * PAGE_SIZE_4K, pos, UIO_READ);
+    }
+    result = VOP_READ(file, &k_uio);
+    slots_mark_busy(offset / PAGE_SIZE_4K, n, false);
+    // a process killed meanwhile has given its slots up with its page table
+    process = get_live_process(pid);
+    if (result || process == NULL) {
+        for (unsigned i = 1; i < n; ++i) {
+            frame_free(frames[i]);
+        }
+        io_end(&io);
+        io_untrack(&io);
+        return result ? result : seL4_IllegalOperation;
     }
     // printf("read finish\n");
-    if (!result) {
-        // update free list
-        tmp = header;
-        header = offset / PAGE_SIZE_4K;
-        uio_kinit(&k_uio, (seL4_Word)&tmp, sizeof(unsigned), offset, UIO_WRITE);
-        result = VOP_WRITE(swap_file, &k_uio);
-    }
-    swap_lock = 0;
+    vmstat_events.swap_ins++;
+    swap_cache_keep((sos_frame_vaddr - FRAME_BASE) / PAGE_SIZE_4K, offset / PAGE_SIZE_4K);
+    if (n > 1) {
+        memcpy((void *)sos_frame_vaddr, io.buf, PAGE_SIZE_4K);
+    }
+    // the rest stay unmapped until touched, the clock takes them first if not
+    for (unsigned i = 1; i < n; ++i) {
+        seL4_Word page = vaddr + i * PAGE_SIZE_4K;
+        memcpy((void *)(FRAME_BASE + PAGE_SIZE_4K * frames[i]),
+               io.buf + i * PAGE_SIZE_4K, PAGE_SIZE_4K);
+        swap_cache_keep(frames[i], offset / PAGE_SIZE_4K + i);
+        stage_page(process->pt, page, frames[i]);
+        frame_rmap_add(frames[i], process->status.pid, page);
+        FRAME_SET_BIT(frames[i], PREFETCH);
+        FRAME_CLEAR_BIT(frames[i], CLOCK);
+        FRAME_CLEAR_BIT(frames[i], PIN);
+    }
+    io_end(&io);
+    // the faulting page itself is mapped by our caller straight away
+    io_untrack(&io);
     return result;
 }
 
-seL4_Error try_swap_out(void)
+/*
+ * open the swapping files that aren't yet and grow each to its full size
+ * in one go
+ */
+static int swap_open(void)
 {
-    int clock_bit, pin_bit;
-    seL4_Error err = seL4_NotEnoughMemory;
-    struct proc *process;
-    seL4_Word file_offset = 0;
     struct uio k_uio;
-    unsigned tmp = 0;
+    char zero = 0;
+    char name[16];
+
+    for (unsigned i = 0; i < SWAP_FILES; ++i) {
+        if (swap_files[i] != NULL) {
+            continue;
+        }
+        snprintf(name, sizeof(name), "swapping%u", i);
+        int result = vfs_open(name, O_RDWR, 0666, &swap_files[i]);
+        if (result) {
+            swap_files[i] = NULL;
+            return result;
+        }
+        uio_kinit(&k_uio, (seL4_Word)&zero, 1, (size_t)SWAP_FILE_PAGES * PAGE_SIZE_4K - 1,
+                  UIO_WRITE);
+        result = VOP_WRITE(swap_files[i], &k_uio);
+        if (result) {
+            return result;
+        }
+    }
+    return 0;
+}
+
+/* the swapping files, whoever needs them first opens them */
+static int swap_ready(void)
+{
     void *aborted = 0;
-    int result = 0;
-    // still need to figure out the actual size of all the frames
-    // no need to go all the way down to the length since many of them
-    // have already been retyped into page table object or thread control block
-    unsigned size = frame_table.max;
-    while (swap_lock == 1) {
+    while (swap_opening && !aborted) {
         aborted = yield(NULL);
     }
     if (aborted) {
-        swap_lock = 0;
-        return seL4_IllegalOperation;
+        return EINTR;
+    }
+    if (swap_files[SWAP_FILES - 1] != NULL) {
+        return 0;
+    }
+    swap_opening = true;
+    int result = swap_open();
+    swap_opening = false;
+    return result;
+}
+
+/* number of frames from the start of frames that sit next to each other */
+static unsigned frames_contiguous(int *frames, unsigned n)
+{
+    unsigned i = 1;
+    while (i < n && frames[i] == frames[0] + (int)i) {
+        i++;
     }
-    swap_lock = 1;
-    // go through the frame table to find the victim
-    for (unsigned j = first_available_frame; j < size * 2; ++j) {
-        if (clock_hand == frame_table.max - 1u) {
-            clock_hand = first_available_frame;
-        }
-        pin_bit = FRAME_GET_BIT(clock_hand, PIN);
-
-        if (!pin_bit) {
-            clock_bit = FRAME_GET_BIT(clock_hand, CLOCK);
-            int pid = GET_PID(clock_hand);
-            process = get_process(pid);
-            //assert(process);
-            if (clock_bit) {
-                // unmap the page and set the clock bit to 0
-                FRAME_CLEAR_BIT(clock_hand, CLOCK);
-                seL4_CPtr cap = get_cap_from_vaddr(process->pt,
-                                                   frame_table.frames[clock_hand].vaddr);
-                // printf("clock hand %d, cap %d, pid is %d, %p\n", clock_hand, cap, pid,
-                // frame_table.frames[clock_hand].vaddr);
-                seL4_ARM_Page_Unmap(cap);
-                cspace_delete(global_cspace, cap);
-                cspace_free_slot(global_cspace, cap);
-                update_page_status(process->pt, frame_table.frames[clock_hand].vaddr, true,
-                                   true, 0);
-
-            } else {
-                // victim found
-                // printf("process is %d victim's vaddr is %p\n", pid, frame_table.frames[clock_hand].vaddr);
-                // printf("victim's cap is %d\n", frame_table.frames[clock_hand].ut->cap);
-                file_offset = header * PAGE_SIZE_4K;
-                if (swap_file == NULL) {
-                    seL4_Word tmp = 1;
-                    result = vfs_open("swapping", O_RDWR, 0666, &swap_file);
-                    if (result) {
-                        swap_lock = 0;
-                        return seL4_IllegalOperation;
-                    }
-                    uio_kinit(&k_uio, (seL4_Word)&tmp, sizeof(unsigned), 0, UIO_WRITE);
-                    result = VOP_WRITE(swap_file, &k_uio);
-                    if (result) {
-                        swap_lock = 0;
-                        return seL4_IllegalOperation;
-                    }
-                }
-
-                //int prev_header = header;
-                //int prev_tail = tail;
-                // printf("###try read\n");
-
-                // set the victim's status to unpresent
-                // here file_offset -1 is a placeholder
-                // and should never be used otherwise it
-                // will trigger a nfs fault
-                update_page_status(process->pt, frame_table.frames[clock_hand].vaddr, false,
-                                   true, -1);
-
-                if (header == tail) {
-                    tail++;
-                    header++;
-                } else {
-                    // read the free list header from the swapping file
-                    uio_kinit(&k_uio, (seL4_Word)&tmp, sizeof(unsigned), file_offset, UIO_READ);
-                    result = VOP_READ(swap_file, &k_uio);
-                    if (result) {
-                        swap_lock = 0;
-                        return seL4_IllegalOperation;
-                    }
-                    header = tmp;
-                }
-
-                // clock_bit = FRAME_GET_BIT(clock_hand, CLOCK);
-                // if (clock_bit) {
-                //     // should never come here
-                //     assert(false);
-                //     printf("racing issue\n");
-                //     header = prev_header;
-                //     tail = prev_tail;
-                //     clock_hand++;
-                //     continue;
-                // }
-
-                // update the present bit & offset
-                // printf("###try update\n");
-
-                update_page_status(process->pt, frame_table.frames[clock_hand].vaddr, false,
-                                   true, file_offset + 1);
-                // write out the page into disk
-                uio_kinit(&k_uio, FRAME_BASE + PAGE_SIZE_4K * clock_hand, PAGE_SIZE_4K,
-                          file_offset, UIO_WRITE);
-                // printf("###try write\n");
-
-                result = VOP_WRITE(swap_file, &k_uio);
-                if (result) {
-                    swap_lock = 0;
-                    return seL4_IllegalOperation;
-                }
-                // printf("###write done\n");
-                // free the frame
-
-
-                frame_free(clock_hand);
-                err = seL4_NoError;
-                clock_hand++;
-                break;
+    return i;
+}
+
+/*
+ * write n frames out to the swapping files in as few transfers as the free
+ * slots allow, frames[i] goes to offsets[i]. frames next to each other go
+ * straight from the frame table a stripe at most, others are gathered
+ * SWAP_CLUSTER at a time. on failure the frames before *written are out, and their slots
+ * stay taken. the frames must be pinned, every transfer takes its own
+ * place in the pipeline
+ */
+static int swap_write_frames(int *frames, unsigned n, seL4_Word *offsets,
+                             unsigned *written)
+{
+    struct uio k_uio;
+    swap_io io;
+    int result;
+
+    *written = 0;
+    result = swap_ready();
+    if (result) {
+        return result;
+    }
+
+    while (*written < n) {
+        unsigned done = *written;
+        unsigned want = MIN(frames_contiguous(frames + done, n - done), (unsigned)SWAP_STRIPE);
+        bool gather = want == 1 && n - done > 1;
+        if (gather) {
+            want = MIN(n - done, (unsigned)SWAP_CLUSTER);
+        }
+        // take a shorter run rather than nothing when slots are fragmented
+        int slot;
+        while ((slot = slot_alloc_run(want)) == -1 && want > 1) {
+            want /= 2;
+        }
+        if (slot == -1) {
+            return ENOSPC;
+        }
+        if (!io_start(&io, gather && want > 1)) {
+            for (unsigned i = 0; i < want; ++i) {
+                slot_free(slot + i);
+            }
+            return EINTR;
+        }
+
+        seL4_Word src = FRAME_BASE + PAGE_SIZE_4K * frames[done];
+        if (io.buf) {
+            for (unsigned i = 0; i < want; ++i) {
+                memcpy(io.buf + i * PAGE_SIZE_4K,
+                       (void *)(FRAME_BASE + PAGE_SIZE_4K * frames[done + i]), PAGE_SIZE_4K);
             }
+            src = (seL4_Word)io.buf;
+        }
+        seL4_Word offset = (seL4_Word)slot * PAGE_SIZE_4K;
+        size_t pos;
+        struct vnode *file = slot_file(slot, &pos);
+        uio_kinit(&k_uio, src, want * PAGE_SIZE_4K, pos, UIO_WRITE);
+        result = VOP_WRITE(file, &k_uio);
+        io_end(&io);
+        if (result) {
+            for (unsigned i = 0; i < want; ++i) {
+                slot_free(slot + i);
+            }
+            return result;
+        }
+        for (unsigned i = 0; i < want; ++i) {
+            offsets[done + i] = offset + i * PAGE_SIZE_4K;
         }
-        clock_hand++;
+        *written += want;
+        vmstat_events.swap_outs += want;
     }
-    swap_lock = 0;
-    return err;
+    return 0;
 }
 
-void clean_up_swapping(unsigned offset)
+/* one page from SOS's own memory to a new slot */
+int swap_write_buffer(void *buf, seL4_Word *offset)
 {
     struct uio k_uio;
+    swap_io io;
     int result;
-    int *aborted = 0;
-    offset = offset - 1;
-    while (swap_lock == 1) {
-        aborted = yield(NULL);
+
+    result = swap_ready();
+    if (result) {
+        return result;
     }
-    if (aborted) {
-        swap_lock = 0;
+    int slot = slot_alloc_run(1);
+    if (slot == -1) {
+        return ENOSPC;
+    }
+    if (!io_start(&io, false)) {
+        slot_free(slot);
+        return EINTR;
+    }
+    size_t pos;
+    struct vnode *file = slot_file(slot, &pos);
+    *offset = (seL4_Word)slot * PAGE_SIZE_4K;
+    uio_kinit(&k_uio, (seL4_Word)buf, PAGE_SIZE_4K, pos, UIO_WRITE);
+    result = VOP_WRITE(file, &k_uio);
+    io_end(&io);
+    if (result) {
+        slot_free(slot);
+        return result;
+    }
+    vmstat_events.swap_outs++;
+    return 0;
+}
+
+/*
+ * a cold large page gets split, its mapping goes, the 4K pieces are written
+ * out in as few runs of slots as possible and the 2M frame goes back to the
+ * large untypeds. this
+ * frees no 4K memory so the clock has to keep looking for a victim after.
+ */
+static int swap_out_large(proc *process, int frame)
+{
+    seL4_Word base = frame_table.vaddr[frame];
+    int frames[FRAME_LARGE_PAGES];
+    seL4_Word offsets[FRAME_LARGE_PAGES];
+    unsigned written;
+    swap_io io;
+    int result;
+    int pid = process->status.pid;
+
+    FRAME_SET_BIT(frame, PIN);
+    demote_large_page(process, base);
+    // placeholders until each piece is written, faults on them wait for us
+    io_track(&io, process, base, FRAME_LARGE_PAGES);
+    for (unsigned i = 0; i < FRAME_LARGE_PAGES; ++i) {
+        update_page_status(process->pt, base + i * PAGE_SIZE_4K, false, true, IN_TRANSIT);
+    }
+    for (unsigned i = 0; i < FRAME_LARGE_PAGES; ++i) {
+        frames[i] = frame + i;
+    }
+    result = swap_write_frames(frames, FRAME_LARGE_PAGES, offsets, &written);
+    process = get_live_process(pid);
+    if (process == NULL) {
+        // killed meanwhile, its page table is gone and so are the pieces
+        for (unsigned i = 0; i < written; ++i) {
+            slot_free(offsets[i] / PAGE_SIZE_4K);
+        }
+        frame_large_free(frame);
+        io_untrack(&io);
+        return result;
+    }
+    for (unsigned i = 0; i < written; ++i) {
+        seL4_Word vaddr = base + i * PAGE_SIZE_4K;
+        if (_get_frame_from_vaddr(process->pt, vaddr) != IN_TRANSIT) {
+            // the range went away meanwhile, nobody needs the copy
+            slot_free(offsets[i] / PAGE_SIZE_4K);
+            continue;
+        }
+        update_page_status(process->pt, vaddr, false, true, offsets[i] + 1);
+    }
+    if (result) {
+        // the frame still has every piece, so it takes them all back and
+        // the pieces already written give their slots up
+        bool kept = true;
+        for (unsigned i = 0; i < FRAME_LARGE_PAGES; ++i) {
+            seL4_Word entry = _get_frame_from_vaddr(process->pt, base + i * PAGE_SIZE_4K);
+            if (i < written && entry == offsets[i] + 1) {
+                slot_free(offsets[i] / PAGE_SIZE_4K);
+            } else if (entry != IN_TRANSIT) {
+                kept = false;
+            }
+        }
+        if (kept) {
+            restore_large_page(process, base, frame);
+            FRAME_CLEAR_BIT(frame, PIN);
+        } else {
+            frame_large_free(frame);
+        }
+        io_untrack(&io);
+        return result;
+    }
+    io_untrack(&io);
+    process->status.evictions += written;
+    frame_large_free(frame);
+    return 0;
+}
+
+/* take one process's mapping of a frame away, the entry stays present */
+static void unmap_mapper(proc *process, seL4_Word vaddr, UNUSED seL4_Word arg)
+{
+    unmap_page(process->pt, vaddr);
+}
+
+/* point one process's entry at the swapping file */
+static void swap_mapper(proc *process, seL4_Word vaddr, seL4_Word file_offset)
+{
+    process->status.evictions++;
+    update_page_status(process->pt, vaddr, false, true, file_offset);
+}
+
+static void for_each_mapper(int frame, void (*fn)(proc *, seL4_Word, seL4_Word),
+                            seL4_Word arg)
+{
+    if (FRAME_GET_BIT(frame, MAPPED)) {
+        fn(get_process(GET_PID(frame)), frame_table.vaddr[frame], arg);
+    }
+    for (frame_rmap *r = frame_table.rmap[frame]; r; r = r->next) {
+        fn(get_process(r->pid), r->vaddr, arg);
+    }
+}
+
+/* nothing but zeros in the frame, eight words at a time so it vectorizes */
+static bool frame_is_zero(int frame)
+{
+    const uint64_t *p = (const uint64_t *)(FRAME_BASE + PAGE_SIZE_4K * frame);
+    for (unsigned i = 0; i < PAGE_SIZE_4K / sizeof(uint64_t); i += 8) {
+        if (p[i] | p[i + 1] | p[i + 2] | p[i + 3] | p[i + 4] | p[i + 5] | p[i + 6] | p[i + 7]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * put the victims away and give back every one nobody touched while that
+ * was going on, returns how many frames were freed. a victim of zeros
+ * needs nothing kept at all, a clean victim still has its data in its slot
+ * and costs no I/O either, a dirty one goes to the compressed pool if it is
+ * worth it there, the rest are written out together
+ */
+static unsigned swap_out_victims(int *victims, unsigned n)
+{
+    int dirty[SWAP_CLUSTER];
+    seL4_Word offsets[SWAP_CLUSTER];
+    /* what the victim's page table entries become, 0 while it can't go */
+    seL4_Word entry[SWAP_CLUSTER];
+    unsigned ndirty = 0, written = 0, freed = 0;
+
+    for (unsigned i = 0; i < n; ++i) {
+        entry[i] = 0;
+        if (frame_is_zero(victims[i])) {
+            entry[i] = ZERO_PAGE | UNMAPPED;
+        } else if (!frame_table.slot[victims[i]] && !zswap_store(victims[i], &entry[i])) {
+            dirty[ndirty++] = victims[i];
+        }
+    }
+    if (ndirty) {
+        swap_write_frames(dirty, ndirty, offsets, &written);
+    }
+    for (unsigned i = 0, d = 0; i < n; ++i) {
+        int frame = victims[i];
+        bool touched = FRAME_GET_BIT(frame, CLOCK) || frame_table.frames[frame].refcount == 1;
+        bool is_dirty = d < ndirty && dirty[d] == frame;
+        if (is_dirty) {
+            entry[i] = d < written ? offsets[d] + 1 : 0;
+            d++;
+        } else if (!entry[i] && frame_table.slot[frame]) {
+            entry[i] = (frame_table.slot[frame] - 1) * PAGE_SIZE_4K + 1;
+        }
+        if (!entry[i] || touched) {
+            // remapped, unmapped for good or not put away, it stays
+            if (entry[i] & ZSWAPPED) {
+                zswap_free(entry[i]);
+            } else if (entry[i] && is_dirty) {
+                slot_free((entry[i] - 1) / PAGE_SIZE_4K);
+            }
+            if (!FRAME_GET_BIT(frame, CLOCK)) {
+                FRAME_CLEAR_BIT(frame, PIN);
+            }
+            frame_free(frame);
+            continue;
+        }
+        if (entry[i] & ZERO_PAGE) {
+            // a slot it may still have goes with the frame
+            vmstat_events.zero_evictions++;
+        } else if (entry[i] & ZSWAPPED) {
+            zswap_commit(entry[i]);
+        } else {
+            if (!is_dirty) {
+                // the slot goes from the frame to the page table entries
+                frame_table.slot[frame] = 0;
+                vmstat_events.swap_clean++;
+            }
+            slot_refs[(entry[i] - 1) / PAGE_SIZE_4K] = frame_nmappers(frame);
+        }
+        for_each_mapper(frame, swap_mapper, entry[i]);
+        if (freed && zswap_starved()) {
+            // nothing was free for the pool to grow into, it keeps this one
+            frame_recycle(frame);
+            zswap_grow(frame);
+            continue;
+        }
+        // free the frame, the caller wants the untyped memory
+        // so it must not be parked in the free pool
+        frame_release(frame);
+        freed++;
+    }
+    return freed;
+}
+
+bool page_candidate(int frame, int owner)
+{
+    return owner < 0 || (FRAME_GET_BIT(frame, MAPPED)
+                         && get_process(GET_PID(frame)) == get_process(owner));
+}
+
+void page_seen(int frame)
+{
+    if (FRAME_GET_BIT(frame, CLOCK)) {
+        frame_table.ref_sweep[frame] = sweep;
+    }
+    if (FRAME_GET_BIT(frame, MAPPED)
+        && (uint8_t)(sweep - frame_table.ref_sweep[frame]) < WSS_SWEEPS) {
+        get_process(GET_PID(frame))->ws_seen++;
+    }
+}
+
+void page_lap(void)
+{
+    proc_sweep_done();
+    sweep++;
+}
+
+bool page_spared(int frame, unsigned share)
+{
+    return get_process(GET_PID(frame))->rss < share;
+}
+
+void page_age(int frame)
+{
+    FRAME_CLEAR_BIT(frame, CLOCK);
+    if (FRAME_GET_BIT(frame, LARGE_FRAME)) {
+        unmap_large_page(get_process(GET_PID(frame)), frame_table.vaddr[frame]);
+    } else {
+        // from everyone sharing it
+        for_each_mapper(frame, unmap_mapper, 0);
+    }
+}
+
+int page_evict(int frame, int *victims, unsigned *n)
+{
+    if (FRAME_GET_BIT(frame, LARGE_FRAME)) {
+        // a cold large page only gets split and written out, it's not a victim
+        return swap_out_large(get_process(GET_PID(frame)), frame);
+    }
+    // take it away from every sharer. the entries stay present, so a fault
+    // during the write simply maps it again and sets the clock bit, which
+    // keeps it in memory. the pin and the extra reference keep the
+    // replacement and frame_free off it meanwhile
+    for_each_mapper(frame, unmap_mapper, 0);
+    FRAME_SET_BIT(frame, PIN);
+    frame_ref(frame);
+    victims[(*n)++] = frame;
+    return 0;
+}
+
+/*
+ * have the replacement policy pick up to SWAP_CLUSTER victims and write
+ * them out in one go. with owner >= 0 only frames mapped by that process
+ * are looked at. several may run at once, a victim is pinned until its
+ * eviction is settled so the others pass it by.
+ */
+static seL4_Error swap_out(int owner)
+{
+    int victims[SWAP_CLUSTER];
+    unsigned nvictims = replace_select(owner, victims, SWAP_CLUSTER);
+    unsigned freed = nvictims ? swap_out_victims(victims, nvictims) : 0;
+    return freed ? seL4_NoError : seL4_NotEnoughMemory;
+}
+
+seL4_Error try_swap_out(void)
+{
+    // a pooled frame is cheaper to give back than anything on the clock
+    if (frame_pool_reclaim()) {
+        return seL4_NoError;
+    }
+    return swap_out(-1);
+}
+
+seL4_Error swap_out_process(proc *process)
+{
+    return swap_out(process->status.pid);
+}
+
+void clean_up_swapping(seL4_Word entry)
+{
+    if (entry == IN_TRANSIT) {
+        // the writer finds the range gone and gives its slot back
+        return;
+    }
+    if (entry & ZSWAPPED) {
+        zswap_free(entry);
         return;
     }
-    swap_lock = 1;
-    uio_kinit(&k_uio, (seL4_Word)&header, sizeof(unsigned), offset, UIO_WRITE);
-    // printf("try write\n");
-    result = VOP_WRITE(swap_file, &k_uio);
-    // printf("try write done\n");
-    header = offset / PAGE_SIZE_4K;
-    swap_lock = 0;
-    // printf("clean up swapping file offset is %u\n", offset);
-}
\ No newline at end of file
+    // nothing is kept in the file, forgetting the slot is enough
+    slot_put(((entry & OFFSET) - 1) / PAGE_SIZE_4K);
+}
+
+void swap_stat(unsigned *used, unsigned *total)
+{
+    *used = slots_used;
+    *total = SWAP_SLOTS;
+}
@@ -2,6 +2,9 @@
 #include "../addrspace.h"
 #include "../proc.h"
 #include "../pagetable.h"
+#include "../frametable.h"
+#include "../dedup.h"
+#include "../vmstat.h"
 #include <fcntl.h>
 #include <aos/debug.h>
 #include <aos/sel4_zf_logif.h>
@@ -13,8 +16,6 @@
 #include "../network.h"
 #include "../vfs/uio.h"
 
-int get_header(void);
-
 typedef  void *(*coro_t)(void *);
 cspace_t *global_cspace;
 struct serial *serial;
@@ -237,6 +238,14 @@ void handle_syscall(seL4_Word badge, int num_args)
 
     }
 
+    case SOS_SYS_VMSTAT: {
+        coro c = coroutine((coro_t)_sys_vmstat);
+        cur_proc->c = c;
+        resume(c, cur_proc);
+        create_coroutine(c);
+        break;
+    }
+
     default:
         ZF_LOGE("Unknown syscall %lu\n", syscall_number);
         /* don't reply to an unknown syscall */
@@ -247,12 +256,37 @@ void handle_syscall(seL4_Word badge, int num_args)
 NORETURN void syscall_loop(seL4_CPtr ep)
 {
 
+    coro idle = NULL;
+    coro scanner = NULL;
+
     while (1) {
         seL4_Word badge;
         seL4_Word label;
-        /* Block on ep, waiting for an IPC sent over ep, or
-         * a notification from our bound notification object */
-        seL4_MessageInfo_t message = seL4_Recv(ep, &badge);
+        seL4_MessageInfo_t message;
+        if (frame_zero_pending() || dedup_pending()) {
+            /* there is background work, so only poll ep and run the
+             * idle coroutines if nobody is waiting on us */
+            message = seL4_NBRecv(ep, &badge);
+            if (badge == 0) {
+                /* a cleared frame pays off sooner than a merged one */
+                if (frame_zero_pending()) {
+                    if (idle == NULL || !resumable(idle)) {
+                        idle = coroutine(frame_zero_worker);
+                    }
+                    resume(idle, NULL);
+                } else {
+                    if (scanner == NULL || !resumable(scanner)) {
+                        scanner = coroutine(dedup_worker);
+                    }
+                    resume(scanner, NULL);
+                }
+                continue;
+            }
+        } else {
+            /* Block on ep, waiting for an IPC sent over ep, or
+             * a notification from our bound notification object */
+            message = seL4_Recv(ep, &badge);
+        }
         /* Awake! We got a message - check the label and badge to
          * see what the message is about */
         label = seL4_MessageInfo_get_label(message);
@@ -274,9 +308,9 @@ NORETURN void syscall_loop(seL4_CPtr ep)
         } else if (label == seL4_Fault_NullFault) {
             /* It's not a fault or an interrupt, it must be an IPC
              * message from tty_test! */
-            handle_syscall(badge, seL4_MessageInfo_get_length(message) - 1);
+            handle_syscall(badge & ~PROCESS_EP_BADGE, seL4_MessageInfo_get_length(message) - 1);
         } else {
-            proc *cur_proc = get_process(badge);
+            proc *cur_proc = get_process(badge & ~PROCESS_EP_BADGE);
             // set_cur_proc(cur_proc);
 
             seL4_CPtr reply = cspace_alloc_slot(global_cspace);
@@ -341,6 +375,7 @@ void _sys_brk(proc *cur_proc)
             return;
         } else {
             region->size = newbrk - region->vaddr;
+            as_region_resized(cur_proc->as, region);
         }
 
     }
@@ -351,7 +386,6 @@ void _sys_brk(proc *cur_proc)
 void _sys_mmap(proc *cur_proc)
 {
     seL4_Error err;
-    as_region *region;
     if (cur_proc->as->heap == NULL) {
         err = as_define_heap(cur_proc->as);
         if (err) {
@@ -362,16 +396,10 @@ void _sys_mmap(proc *cur_proc)
     }
     seL4_Word size = seL4_GetMR(2);
 
-    region = cur_proc->as->regions;
     as_region *ret = NULL;
-    while (region->next != NULL) {
-        seL4_Word base = ((region->vaddr + region->size) & PAGE_FRAME) + 4096;
-        seL4_Word top = region->next->vaddr;
-        if (base + size < top) {
-            ret = as_define_region(cur_proc->as, base, size, RG_R | RG_W);
-            break;
-        }
-        region = region->next;
+    seL4_Word base = as_find_gap(cur_proc->as, size);
+    if (base) {
+        ret = as_define_region(cur_proc->as, base, size, RG_R | RG_W | RG_LARGE);
     }
     if (ret) {
         syscall_reply(cur_proc, ret->vaddr, 0);
@@ -383,16 +411,10 @@ void _sys_mmap(proc *cur_proc)
 void *_sys_munmap(proc *cur_proc)
 {
     seL4_Word ret;
-    as_region *region = cur_proc->as->regions;
     seL4_Word base = seL4_GetMR(1);
-    while (region) {
-        if (region->vaddr == base) {
-            as_destroy_region(cur_proc->as, region, cur_proc);
-            break;
-        }
-        region = region->next;
-    }
-    if (region) {
+    as_region *region = vaddr_get_region(cur_proc->as, base);
+    if (region && region->vaddr == base) {
+        as_destroy_region(cur_proc->as, region, cur_proc);
         ret = base;
     } else {
         ret = 0;
@@ -413,7 +435,7 @@ void *_sys_create_process(proc *cur_proc)
         return NULL;
     }
 
-    bool success = start_process(app_name, ipc_ep, &ret_pid);
+    bool success = start_process(app_name, ipc_ep, PROC_RSS_LIMIT, &ret_pid);
     if (!success) {
         if (ret_pid == -1) {
             syscall_reply(cur_proc, -1, -1);
@@ -466,6 +488,7 @@ void *_sys_process_status(proc *cur_proc)
     for (int i = 0; i < PROCESS_ARRAY_SIZE; i++) {
         if (get_process(i) && get_process(i)->state == ACTIVE) {
             k_processes[index] = get_process(i)->status;
+            k_processes[index].rss = get_process(i)->rss;
             index++;
             if (index == max) {
                 break;
@@ -482,4 +505,20 @@ void *_sys_process_status(proc *cur_proc)
     }
     syscall_reply(cur_proc, index, 0);
     return NULL;
-}
\ No newline at end of file
+}
+
+void *_sys_vmstat(proc *cur_proc)
+{
+    void *u_ptr = (void *)seL4_GetMR(1);
+    sos_vmstat_t stat;
+
+    vmstat_snapshot(&stat);
+    int ret = mem_move(cur_proc, (seL4_Word) u_ptr, (seL4_Word) &stat,
+                       sizeof(sos_vmstat_t), READ);
+    if (ret == -1) {
+        syscall_reply(cur_proc, -1, -1);
+        return NULL;
+    }
+    syscall_reply(cur_proc, 0, 0);
+    return NULL;
+}
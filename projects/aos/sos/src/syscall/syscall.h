@@ -20,6 +20,10 @@ typedef struct proc proc;
 #define IRQ_BADGE_NETWORK_TICK BIT(1)
 #define IRQ_BADGE_TIMER BIT(2)
 
+/* Process endpoints are minted with this bit set on top of the pid, so that a
+ * badge of 0 only ever means seL4_NBRecv found nothing to receive. */
+#define PROCESS_EP_BADGE BIT(seL4_BadgeBits - 2)
+
 /* System calls for SOS */
 #define SOS_SYS_READ                0
 #define SOS_SYS_WRITE               1
@@ -34,6 +38,7 @@ typedef struct proc proc;
 #define SOS_SYS_PROCESS_WAIT        10
 #define SOS_SYS_TIMESTAMP           11
 #define SOS_SYS_USLEEP              12
+#define SOS_SYS_VMSTAT              13
 #define SOS_SYSCALLMSG              100
 #define SOS_SYSCALLBRK              101
 #define SOS_SYSCALL_MMAP            102
@@ -86,4 +91,6 @@ void _sys_process_wait(proc *cur_proc);
 
 void *_sys_kill_process(proc *cur_proc);
 
-void *_sys_process_status(proc *cur_proc);
\ No newline at end of file
+void *_sys_process_status(proc *cur_proc);
+
+void *_sys_vmstat(proc *cur_proc);
\ No newline at end of file
@@ -78,6 +78,34 @@ void ut_add_untyped_range(seL4_Word paddr, seL4_CPtr cap, size_t n, bool device)
     }
 }
 
+void ut_add_large_untyped(seL4_Word paddr, seL4_CPtr cap)
+{
+    ut_t *node = paddr_to_ut(paddr);
+    node->cap = cap;
+    node->valid = 1;
+    push(&table.free_large, node);
+    table.n_large_untyped++;
+}
+
+size_t ut_n_large_untyped(void)
+{
+    return table.n_large_untyped;
+}
+
+ut_t *ut_alloc_large_untyped(uintptr_t *paddr)
+{
+    if (table.free_large == NULL) {
+        return NULL;
+    }
+
+    ut_t *n = pop(&table.free_large);
+    if (paddr) {
+        *paddr = ut_to_paddr(n);
+    }
+    ZF_LOGD("Allocated large %lx, cap %lx", ut_to_paddr(n), n->cap);
+    return n;
+}
+
 ut_t *ut_alloc_4k_untyped(uintptr_t *paddr)
 {
     ut_t **list = &table.free_untypeds[SIZE_BITS_TO_INDEX(seL4_PageBits)];
@@ -213,6 +241,11 @@ ut_t *ut_alloc(size_t size_bits, cspace_t *cspace)
 
 void ut_free(ut_t *node, size_t size_bits)
 {
+    if (size_bits == seL4_LargePageBits) {
+        push(&table.free_large, node);
+        return;
+    }
+
     if (size_bits < seL4_EndpointBits || size_bits > seL4_PageBits) {
         ZF_LOGE("Invalid size bits %zu", size_bits);
         return;
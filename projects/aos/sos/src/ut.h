@@ -57,6 +57,11 @@ typedef struct {
     ut_t *free_untypeds[N_UNTYPED_LISTS];
     /* the number of non-device 4k untypeds this table is managing */
     size_t n_4k_untyped;
+    /* list of free 2M untypeds set aside at boot for large pages, the node for
+     * each one is the table entry of its first 4K */
+    ut_t *free_large;
+    /* the number of 2M untypeds this table is managing */
+    size_t n_large_untyped;
     /* list of unused nodes which can be used to populate untyped lists
      * of untyped objects < 4K in size, where the bookkeping data is allocated on demand from the 4k
      * untypeds free list */
@@ -111,6 +116,27 @@ void ut_add_untyped_range(seL4_Word paddr, seL4_CPtr cap, size_t n, bool device)
  */
 ut_t *ut_alloc_4k_untyped(uintptr_t *paddr);
 
+/**
+ * Add a 2M (seL4_LargePageBits) untyped to the table. The paddr must be in the range
+ * provided to ut_init and must not overlap any range given to ut_add_untyped_range.
+ *
+ * @param paddr  the physical address of the untyped
+ * @param cap    the cptr of the untyped
+ */
+void ut_add_large_untyped(seL4_Word paddr, seL4_CPtr cap);
+
+/* Return the number of 2M untypeds the ut_table is managing. Like ut_size, it never changes. */
+size_t ut_n_large_untyped(void);
+
+/**
+ * Allocate a 2M untyped object. Free it with ut_free(ut, seL4_LargePageBits).
+ *
+ * @param paddr[out]  return the physical address of the untyped memory here. NULL
+ *                    if no value should be returned.
+ * @return            the table entry representing the untyped, NULL if none are left.
+ */
+ut_t *ut_alloc_large_untyped(uintptr_t *paddr);
+
 /**
  * Allocate an untyped of a specific size < seL4_PageBits.
  *
@@ -135,7 +161,8 @@ ut_t *ut_alloc(size_t size_bits, cspace_t *cspace_alloc);
  * bigger objects. It is possible to merge untypeds, but this is not implemented to
  * reduce complexity.
  *
- * Allocations made with ut_alloc_frame and ut_alloc can both be freed with this function.
+ * Allocations made with ut_alloc_frame, ut_alloc and ut_alloc_large_untyped can all be freed
+ * with this function.
  *
  * @param ut        the ut pointer returned by ut_alloc or ut_alloc_4k_untyped
  * @param size_bits the size to the memory to free, that was used for the allocation.
@@ -100,7 +100,7 @@ static void *putchar_to_user(void)
     seL4_Error err;
     while (the_console->n > 0) {
         if (uio->uio_segflg == UIO_USERSPACE) {
-            sos_vaddr = get_sos_virtual_address(the_console->proc->pt, uio->vaddr + idx);
+            sos_vaddr = get_sos_virtual_address(the_console->proc, uio->vaddr + idx, true);
             if (sos_vaddr == 0) {
                 err = handle_page_fault(the_console->proc, uio->vaddr + idx, 0);
                 if (err) {
@@ -109,7 +109,7 @@ static void *putchar_to_user(void)
                     console_lock = 0;
                     return NULL;
                 }
-                sos_vaddr = get_sos_virtual_address(the_console->proc->pt, uio->vaddr + idx);
+                sos_vaddr = get_sos_virtual_address(the_console->proc, uio->vaddr + idx, true);
             }
         } else {
             sos_vaddr = uio->vaddr;
@@ -176,13 +176,13 @@ static int con_io(struct device *dev, struct uio *uio)
     } else {
         while (uio->uio_resid > 0) {
             if (uio->uio_segflg == UIO_USERSPACE) {
-                sos_vaddr = get_sos_virtual_address(uio->proc->pt, user_vaddr);
+                sos_vaddr = get_sos_virtual_address(uio->proc, user_vaddr, false);
                 if (sos_vaddr == 0) {
                     err = handle_page_fault(uio->proc, user_vaddr, 0);
                     if (err) {
                         return err;
                     }
-                    sos_vaddr = get_sos_virtual_address(uio->proc->pt, user_vaddr);
+                    sos_vaddr = get_sos_virtual_address(uio->proc, user_vaddr, false);
                 }
             } else {
                 sos_vaddr = uio->vaddr;
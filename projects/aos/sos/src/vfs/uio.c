@@ -75,13 +75,13 @@ int mem_move(proc *proc, seL4_Word u_vaddr, seL4_Word k_vaddr, size_t len,
         n = len;
     }
     while (len > 0) {
-        seL4_Word vaddr = get_sos_virtual_address(proc->pt, u_vaddr);
+        seL4_Word vaddr = get_sos_virtual_address(proc, u_vaddr, rw == UIO_READ);
         if (!vaddr) {
             err = handle_page_fault(proc, u_vaddr, 0);
             if (err != seL4_NoError) {
                 return -1;
             }
-            vaddr = get_sos_virtual_address(proc->pt, u_vaddr);
+            vaddr = get_sos_virtual_address(proc, u_vaddr, rw == UIO_READ);
         }
         if (rw == UIO_READ) {
             memcpy((void *)vaddr, (void *)k_vaddr, n);
@@ -107,11 +107,11 @@ int copystr(proc *proc, char *user, char *sos, size_t length, enum uio_rw rw)
     }
     seL4_Error err;
     seL4_Word left_size = region->vaddr + region->size - (seL4_Word)region->vaddr;
-    seL4_Word vaddr = get_sos_virtual_address(proc->pt, (seL4_Word)user);
+    seL4_Word vaddr = get_sos_virtual_address(proc, (seL4_Word)user, rw == COPYOUT);
     if (!vaddr) {
         err = handle_page_fault(proc, (seL4_Word)user, 0);
         if (err != seL4_NoError) return -1;
-        vaddr = get_sos_virtual_address(proc->pt, (seL4_Word)user);
+        vaddr = get_sos_virtual_address(proc, (seL4_Word)user, rw == COPYOUT);
     }
     seL4_Word top = (vaddr & PAGE_FRAME) + PAGE_SIZE_4K;
     size_t i = 0;
@@ -132,7 +132,13 @@ int copystr(proc *proc, char *user, char *sos, size_t length, enum uio_rw rw)
         i++;
         j++;
         if ((vaddr + j) >= top) {
-            vaddr = get_sos_virtual_address(proc->pt, (seL4_Word)user + i);
+            vaddr = get_sos_virtual_address(proc, (seL4_Word)user + i, rw == COPYOUT);
+            if (!vaddr) {
+                err = handle_page_fault(proc, (seL4_Word)user + i, 0);
+                if (err != seL4_NoError) return -1;
+                vaddr = get_sos_virtual_address(proc, (seL4_Word)user + i, rw == COPYOUT);
+            }
+            top = vaddr + PAGE_SIZE_4K;
             j = 0;
         }
     }
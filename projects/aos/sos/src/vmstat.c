@@ -0,0 +1,14 @@
+#include "vmstat.h"
+#include "frametable.h"
+#include "pagetable.h"
+#include "zswap.h"
+
+sos_vmstat_t vmstat_events;
+
+void vmstat_snapshot(sos_vmstat_t *stat)
+{
+    *stat = vmstat_events;
+    frame_table_stat(stat);
+    swap_stat(&stat->swap_used, &stat->swap_total);
+    zswap_stat(&stat->zswap_pages, &stat->zswap_frames);
+}
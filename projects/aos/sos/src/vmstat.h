@@ -0,0 +1,39 @@
+#pragma once
+
+/* mirrors sos_vmstat_t of libsosapi's sos.h, keep the two in step */
+typedef struct {
+    unsigned  frames;          /* frames the frame table manages */
+    unsigned  untyped;         /* not backed by memory yet */
+    unsigned  pooled;          /* free but kept retyped and mapped in SOS */
+    unsigned  zeroed;          /* pooled frames already cleared */
+    unsigned  used;            /* user pages the clock may evict */
+    unsigned  pinned;          /* in use and never evicted */
+    unsigned  page_tables;     /* holding shadow page tables */
+    unsigned  large;           /* 2M frames mapped by processes */
+    unsigned  swap_used;       /* swap file slots holding pages */
+    unsigned  swap_total;      /* slots the swap file has grown to */
+    unsigned  zswap_pages;     /* pages kept compressed in memory */
+    unsigned  zswap_frames;    /* frames the compressed pool takes */
+    unsigned  shared;          /* user pages merged into another's frame */
+    unsigned long faults;      /* since boot */
+    unsigned long swap_ins;
+    unsigned long swap_outs;
+    unsigned long zero_fills;      /* frames allocated for pages of zeros */
+    unsigned long zero_maps;       /* read faults served by the shared zero frame */
+    unsigned long zero_evictions;  /* victims of zeros, dropped without I/O */
+    unsigned long prefetch_hits;   /* read-around pages faulted on */
+    unsigned long prefetch_waste;  /* read-around pages dropped untouched */
+    unsigned long swap_clean;      /* evictions whose slot was still good */
+    unsigned long zswap_stores;    /* evictions into the compressed pool */
+    unsigned long zswap_writebacks;    /* pool pages moved on to the file */
+    unsigned long dedup_merges;    /* identical pages merged by the scanner */
+    unsigned long dedup_breaks;    /* merged pages copied on a write */
+    unsigned long around_maps;     /* resident pages mapped around a fault */
+    unsigned long around_fills;    /* zeroed frames mapped around a fault */
+} sos_vmstat_t;
+
+/* the cumulative counters, bumped where the events happen */
+extern sos_vmstat_t vmstat_events;
+
+/* fill stat with the current state of the frame table and swap file */
+void vmstat_snapshot(sos_vmstat_t *stat);
@@ -0,0 +1,104 @@
+#pragma once
+
+/*
+ * the walk down the shadow page table to the level 4 table of an address,
+ * and the cache in front of it. the includer brings seL4_Word,
+ * seL4_LargePageBits, PAGE_SIZE_4K, PAGE_TABLE_SIZE, PAGE_TABLE_FRAME_SIZE,
+ * MASK, MAX_UNSAFE and FRAME_BASE, so sos/bench can build it on the host
+ */
+
+/* the frame index in the low bits of a shadow table entry */
+#define ENTRY_FRAME_BITS 28
+#define ENTRY_FRAME(x) ((x) & MASK(ENTRY_FRAME_BITS))
+#define NODE_TABLE(x) (ENTRY_FRAME(x) ? \
+                       (page_table_t *)(FRAME_BASE + ENTRY_FRAME(x) * PAGE_SIZE_4K) : NULL)
+
+/*
+ * translations the top level table caches, a power of two, 0 turns it off.
+ * off unless asked for: a miss costs the walk and the update, so lookups
+ * spread over more 2M ranges than it holds get slower than without it
+ */
+#ifndef XLATE_ENTRIES
+#ifdef CONFIG_SOS_XLATE_ENTRIES
+#define XLATE_ENTRIES CONFIG_SOS_XLATE_ENTRIES
+#else
+#define XLATE_ENTRIES 0
+#endif
+#endif
+
+typedef struct page_table {
+    seL4_Word page_obj_addr[PAGE_TABLE_SIZE];
+} page_table_t;
+
+/*
+ * level 4 shadow tables by the 2M range they cover, direct mapped. a level
+ * 4 table lives until page_range_trim frees it, which takes it out of the
+ * cache, so what an entry leads to is always the current page table entry
+ */
+typedef struct xlate_entry {
+    seL4_Word tag;
+    page_table_t *pt4;
+} xlate_entry;
+
+typedef struct xlate_cache {
+    xlate_entry entry[MAX_UNSAFE(XLATE_ENTRIES, 1)];
+} xlate_cache;
+
+/* the top level table alone has a second frame, for its translation cache */
+static inline xlate_cache *get_xlate_cache(page_table_t *table)
+{
+    return (xlate_cache *)((seL4_Word)table + PAGE_TABLE_FRAME_SIZE * PAGE_SIZE_4K);
+}
+
+static inline int get_offset(seL4_Word vaddr, int n)
+{
+    seL4_Word mask = 0xff8000000000 >> (9 * (n - 1));
+    seL4_Word offset = (mask & vaddr) >> (48 - 9 * n);
+    return (int)offset;
+}
+
+static inline seL4_Word get_n_level_table(seL4_Word page_table, seL4_Word vaddr, int n)
+{
+    /* page_table is the 1st level, so we start from 2nd level */
+    page_table_t *pt = (page_table_t *)page_table;
+    for (int i = 1; i < n; i++) {
+        int offset = get_offset(vaddr, i);
+        pt = NODE_TABLE(pt->page_obj_addr[offset]);
+        if (pt == NULL) {
+            return 0;
+        }
+    }
+
+    return (seL4_Word)pt;
+}
+
+/* the level 4 shadow table of vaddr, NULL if there is none yet */
+static inline page_table_t *get_leaf_table(page_table_t *table, seL4_Word vaddr)
+{
+    if (XLATE_ENTRIES == 0) {
+        return (page_table_t *)get_n_level_table((seL4_Word)table, vaddr, 4);
+    }
+    seL4_Word tag = vaddr >> seL4_LargePageBits;
+    xlate_entry *e = &get_xlate_cache(table)->entry[tag & (XLATE_ENTRIES - 1)];
+    if (e->pt4 == NULL || e->tag != tag) {
+        page_table_t *pt4 = (page_table_t *)get_n_level_table((seL4_Word)table, vaddr, 4);
+        if (pt4 == NULL) {
+            return NULL;
+        }
+        e->tag = tag;
+        e->pt4 = pt4;
+    }
+    return e->pt4;
+}
+
+static inline void xlate_forget(page_table_t *table, seL4_Word vaddr)
+{
+    if (XLATE_ENTRIES == 0) {
+        return;
+    }
+    seL4_Word tag = vaddr >> seL4_LargePageBits;
+    xlate_entry *e = &get_xlate_cache(table)->entry[tag & (XLATE_ENTRIES - 1)];
+    if (e->tag == tag) {
+        e->pt4 = NULL;
+    }
+}
@@ -0,0 +1,343 @@
+#include "zswap.h"
+#include "frametable.h"
+#include "pagetable.h"
+#include "proc.h"
+#include "vmstat.h"
+#include <autoconf.h>
+#include <string.h>
+#include <lz/lz.h>
+#include <picoro/picoro.h>
+
+/* frames the compressed pool may take, 0 sends every page to the file */
+#ifndef ZSWAP_FRAMES
+#ifdef CONFIG_SOS_ZSWAP_FRAMES
+#define ZSWAP_FRAMES CONFIG_SOS_ZSWAP_FRAMES
+#else
+#define ZSWAP_FRAMES 64
+#endif
+#endif
+/* pool frames are carved into chunks, one bit each in the frame's map */
+#define ZSWAP_CHUNK 64
+#define ZSWAP_CHUNKS (PAGE_SIZE_4K / ZSWAP_CHUNK)
+/* a page that doesn't shrink by a quarter is not worth the memory */
+#define ZSWAP_MAX_LEN (PAGE_SIZE_4K * 3 / 4)
+#define ZSWAP_POOL MAX_UNSAFE(ZSWAP_FRAMES, 1)
+/* every stored page takes a chunk at least */
+#define ZSWAP_ENTRIES (ZSWAP_POOL * ZSWAP_CHUNKS)
+
+enum {
+    ZS_FREE,
+    ZS_NEW,         /* stored, the eviction is still deciding */
+    ZS_STORED,
+    ZS_WRITEBACK,   /* on its way to the swapping file */
+    ZS_DEAD,        /* thrown away while on its way */
+};
+
+typedef struct zswap_entry {
+    /*
+     * fifo while in use, newest first, free list through next. a page
+     * leaves the pool when it is loaded, so the order in which pages came
+     * in is all there is to go by
+     */
+    int prev;
+    int next;
+    seL4_Word vaddr;
+    uint8_t pid;
+    uint8_t state;
+    uint16_t len;
+    uint16_t pool;
+    uint8_t chunk;
+} zswap_entry;
+
+static zswap_entry entries[ZSWAP_ENTRIES];
+static unsigned entries_used = 0;
+static int free_entry = -1;
+static int fifo_head = -1, fifo_tail = -1;
+static unsigned nstored = 0;
+
+/* frame table index + 1 of each pool frame, 0 if the pool doesn't hold it */
+static int pool_frame[ZSWAP_POOL];
+static uint64_t pool_map[ZSWAP_POOL];
+static unsigned pool_frames = 0;
+static bool starved = false;
+
+/* only used between yields, so every coroutine can share them */
+static lz_ctx_t lz;
+static char zbuf[ZSWAP_MAX_LEN];
+/* a page on its way to the swapping file, one at a time */
+static char writeback_buf[PAGE_SIZE_4K];
+static bool writing_back = false;
+
+static void *chunk_addr(unsigned pool, unsigned chunk)
+{
+    return (void *)(FRAME_BASE + PAGE_SIZE_4K * (pool_frame[pool] - 1) + chunk * ZSWAP_CHUNK);
+}
+
+static uint64_t chunk_mask(unsigned chunk, unsigned n)
+{
+    return ((1ull << n) - 1) << chunk;
+}
+
+static bool chunk_alloc(unsigned n, unsigned *pool, unsigned *chunk)
+{
+    for (unsigned p = 0; p < ZSWAP_POOL; ++p) {
+        if (!pool_frame[p] || pool_map[p] == ~0ull) {
+            continue;
+        }
+        for (unsigned c = 0; c + n <= ZSWAP_CHUNKS; ++c) {
+            if (!(pool_map[p] & chunk_mask(c, n))) {
+                pool_map[p] |= chunk_mask(c, n);
+                *pool = p;
+                *chunk = c;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* an empty pool frame goes back at once, the pool only holds what it uses */
+static void chunk_free(unsigned pool, unsigned chunk, unsigned n)
+{
+    pool_map[pool] &= ~chunk_mask(chunk, n);
+    if (!pool_map[pool]) {
+        frame_free(pool_frame[pool] - 1);
+        pool_frame[pool] = 0;
+        pool_frames--;
+    }
+}
+
+static void pool_add(int frame)
+{
+    for (unsigned p = 0; p < ZSWAP_POOL; ++p) {
+        if (!pool_frame[p]) {
+            pool_frame[p] = frame + 1;
+            pool_map[p] = 0;
+            pool_frames++;
+            return;
+        }
+    }
+}
+
+static int entry_alloc(void)
+{
+    int e = free_entry;
+    if (e != -1) {
+        free_entry = entries[e].next;
+    } else if (entries_used < ZSWAP_ENTRIES) {
+        e = entries_used++;
+    } else {
+        return -1;
+    }
+    entries[e].prev = -1;
+    entries[e].next = fifo_head;
+    if (fifo_head != -1) {
+        entries[fifo_head].prev = e;
+    } else {
+        fifo_tail = e;
+    }
+    fifo_head = e;
+    nstored++;
+    return e;
+}
+
+static void entry_release(int e)
+{
+    zswap_entry *z = &entries[e];
+    if (z->prev != -1) {
+        entries[z->prev].next = z->next;
+    } else {
+        fifo_head = z->next;
+    }
+    if (z->next != -1) {
+        entries[z->next].prev = z->prev;
+    } else {
+        fifo_tail = z->prev;
+    }
+    chunk_free(z->pool, z->chunk, DIV_ROUND_UP(z->len, ZSWAP_CHUNK));
+    z->state = ZS_FREE;
+    z->next = free_entry;
+    free_entry = e;
+    nstored--;
+}
+
+/* the entry a page table entry refers to, -1 if there is none */
+static int entry_of(seL4_Word entry)
+{
+    seL4_Word e = entry & OFFSET;
+    if (e >= entries_used || entries[e].state == ZS_FREE) {
+        return -1;
+    }
+    return e;
+}
+
+/*
+ * write the oldest stored page out to the swapping file, its chunks stay
+ * until the write is done so a failed write loses nothing. -1 if another
+ * writeback is already under way
+ */
+static int writeback(void)
+{
+    int e = fifo_tail;
+    seL4_Word offset;
+    int result;
+
+    if (writing_back) {
+        return -1;
+    }
+    // pages of evictions in progress are not ours to move yet
+    while (e != -1 && entries[e].state != ZS_STORED) {
+        e = entries[e].prev;
+    }
+    if (e == -1) {
+        return -1;
+    }
+    zswap_entry *z = &entries[e];
+    if (lz_decompress(chunk_addr(z->pool, z->chunk), z->len, writeback_buf,
+                      PAGE_SIZE_4K) != PAGE_SIZE_4K) {
+        return -1;
+    }
+    z->state = ZS_WRITEBACK;
+    writing_back = true;
+    result = swap_write_buffer(writeback_buf, &offset);
+    writing_back = false;
+    if (result) {
+        if (z->state == ZS_DEAD) {
+            entry_release(e);
+        } else {
+            z->state = ZS_STORED;
+        }
+        return result;
+    }
+    if (z->state == ZS_DEAD) {
+        // the process went away during the write
+        clean_up_swapping(offset + 1);
+    } else {
+        update_page_status(get_process(z->pid)->pt, z->vaddr, false, true, offset + 1);
+    }
+    vmstat_events.zswap_writebacks++;
+    entry_release(e);
+    return 0;
+}
+
+bool zswap_store(int frame, seL4_Word *entry)
+{
+    unsigned pool, chunk;
+    size_t len;
+    int e;
+
+    // a shared page would need every sharer's entry found on writeback
+    if (ZSWAP_FRAMES == 0 || frame_nmappers(frame) != 1) {
+        return false;
+    }
+    len = lz_compress(&lz, (void *)(FRAME_BASE + PAGE_SIZE_4K * frame), PAGE_SIZE_4K,
+                      zbuf, ZSWAP_MAX_LEN);
+    while (len && !chunk_alloc(DIV_ROUND_UP(len, ZSWAP_CHUNK), &pool, &chunk)) {
+        if (pool_frames < ZSWAP_FRAMES) {
+            int f = frame_alloc_noevict(NULL);
+            if (f != -1) {
+                pool_add(f);
+                continue;
+            }
+            starved = true;
+        }
+        // full, the oldest page makes room. the writeback already under
+        // way frees some as well, wait for it and look again
+        if (writing_back) {
+            void *aborted = 0;
+            while (writing_back && !aborted) {
+                aborted = yield(NULL);
+            }
+            if (aborted) {
+                return false;
+            }
+        } else if (writeback()) {
+            return false;
+        }
+        // others may have compressed into zbuf while we were writing
+        len = lz_compress(&lz, (void *)(FRAME_BASE + PAGE_SIZE_4K * frame), PAGE_SIZE_4K,
+                          zbuf, ZSWAP_MAX_LEN);
+    }
+    if (len == 0) {
+        return false;
+    }
+    e = entry_alloc();
+    if (e == -1) {
+        chunk_free(pool, chunk, DIV_ROUND_UP(len, ZSWAP_CHUNK));
+        return false;
+    }
+    memcpy(chunk_addr(pool, chunk), zbuf, len);
+    zswap_entry *z = &entries[e];
+    if (FRAME_GET_BIT(frame, MAPPED)) {
+        z->pid = GET_PID(frame);
+        z->vaddr = frame_table.vaddr[frame];
+    } else {
+        z->pid = frame_table.rmap[frame]->pid;
+        z->vaddr = frame_table.rmap[frame]->vaddr;
+    }
+    z->state = ZS_NEW;
+    z->len = len;
+    z->pool = pool;
+    z->chunk = chunk;
+    *entry = e | ZSWAPPED;
+    return true;
+}
+
+void zswap_commit(seL4_Word entry)
+{
+    int e = entry_of(entry);
+    if (e != -1) {
+        entries[e].state = ZS_STORED;
+        vmstat_events.zswap_stores++;
+    }
+}
+
+int zswap_load(seL4_Word entry, seL4_Word sos_vaddr)
+{
+    int e = entry_of(entry);
+    if (e == -1 || (entries[e].state != ZS_STORED && entries[e].state != ZS_WRITEBACK)) {
+        return -1;
+    }
+    zswap_entry *z = &entries[e];
+    if (lz_decompress(chunk_addr(z->pool, z->chunk), z->len, (void *)sos_vaddr,
+                      PAGE_SIZE_4K) != PAGE_SIZE_4K) {
+        return -1;
+    }
+    if (z->state == ZS_WRITEBACK) {
+        // the writeback throws its copy away when it's done
+        z->state = ZS_DEAD;
+    } else {
+        entry_release(e);
+    }
+    return 0;
+}
+
+void zswap_free(seL4_Word entry)
+{
+    int e = entry_of(entry);
+    if (e == -1) {
+        return;
+    }
+    if (entries[e].state == ZS_WRITEBACK) {
+        entries[e].state = ZS_DEAD;
+    } else if (entries[e].state != ZS_DEAD) {
+        entry_release(e);
+    }
+}
+
+bool zswap_starved(void)
+{
+    return starved && pool_frames < ZSWAP_FRAMES;
+}
+
+void zswap_grow(int frame)
+{
+    starved = false;
+    pool_add(frame);
+}
+
+void zswap_stat(unsigned *pages, unsigned *frames)
+{
+    *pages = nstored;
+    *frames = pool_frames;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <sel4/sel4.h>
+#include <stdbool.h>
+
+/*
+ * compressed tier in front of the swapping file. Evicted pages are kept
+ * compressed in a capped pool of pinned frames, the oldest are written back
+ * to the swapping file once the pool runs full.
+ *
+ * a page table entry of a page in the pool has PRESENT clear and ZSWAPPED
+ * set, the low bits index the pool's entries. pages leave the pool when
+ * they are loaded, so it is first in first out. one page at a time is
+ * written back, a store that needs room meanwhile waits for that write.
+ */
+#define ZSWAPPED (1lu << 49)
+
+/*
+ * compress the frame, a victim of the clock mapped by one process, into the
+ * pool. on success *entry is what its page table entry becomes once the
+ * eviction goes through, which zswap_commit or zswap_free then settle
+ */
+bool zswap_store(int frame, seL4_Word *entry);
+void zswap_commit(seL4_Word entry);
+
+/* decompress the page behind entry into the frame at sos_vaddr, -1 if it failed */
+int zswap_load(seL4_Word entry, seL4_Word sos_vaddr);
+
+/* the page is gone, a page being written back is dropped when the write is done */
+void zswap_free(seL4_Word entry);
+
+/*
+ * a store failed for want of a pool frame, and the pool may grow. the clock
+ * then hands one of its victims to zswap_grow instead of freeing it
+ */
+bool zswap_starved(void);
+void zswap_grow(int frame);
+
+/* pages held in the pool and frames it takes */
+void zswap_stat(unsigned *pages, unsigned *frames);
+
+/* the swapping file below, from swap.c: write a page out to a new slot */
+int swap_write_buffer(void *buf, seL4_Word *offset);